@@ -4,7 +4,11 @@ cd compiler
 cargo build --release
 cd ..
 cd plsa
-g++ main.cpp -o plsa
+# Release build with LTO; see CMakeLists.txt for -march and PGO options.
+# Front-end benchmarks: ./plsa-bench [--shape NAME] [--size MB], see bench.cpp
+cmake -S . -B build -DCMAKE_BUILD_TYPE=Release
+cmake --build build
+cp build/plsa build/plsa-bench .
 cd ..
 cd updater
 go get updater
@@ -7,7 +7,9 @@ cargo build --release
 # source/plsa
 Set-Location ..
 Set-Location plsa
-g++ main.cpp -o plsa
+cmake -S . -B build -G "MinGW Makefiles" -DCMAKE_BUILD_TYPE=Release
+cmake --build build
+Copy-Item build/plsa.exe, build/plsa-bench.exe .
 
 # source/updater
 Set-Location ..
@@ -61,29 +61,14 @@ func main() {
 
 func compile(inputFile string) {
 	outputPre := inputFile + ".pre"
+	outputAst := inputFile + ".ast"
 
-	pterm.DefaultSection.Println("Preprocessing")
-	preprocessor := filepath.Join(binPath, "preprocessor")
-	if runtime.GOOS == "windows" {
-		preprocessor += ".exe"
-	}
-	cmdPre := exec.Command(preprocessor, inputFile, outputPre)
-	if out, err := cmdPre.CombinedOutput(); err != nil {
-		pterm.Error.Println(string(out))
+	pterm.DefaultSection.Println("Preprocessing and Checking")
+	if out, err := preprocessAndCheck(inputFile, outputPre, outputAst); err != nil {
+		pterm.Error.Println(out)
 		os.Exit(1)
 	}
 	pterm.Success.Println("Preprocessing done")
-
-	pterm.DefaultSection.Println("Parsing and Checking")
-	plsa := filepath.Join(binPath, "plsa")
-	if runtime.GOOS == "windows" {
-		plsa += ".exe"
-	}
-	cmdPlsa := exec.Command(plsa, outputPre)
-	if out, err := cmdPlsa.CombinedOutput(); err != nil {
-		pterm.Error.Println(string(out))
-		os.Exit(1)
-	}
 	pterm.Success.Println("PLSA done")
 
 	// Assume diagnostic needs error simulation, but for now skip or mock
@@ -101,7 +86,7 @@ func compile(inputFile string) {
 		compiler += ".exe"
 	}
 	outputObj := inputFile + ".o"
-	cmdComp := exec.Command(compiler, outputPre, outputObj)
+	cmdComp := exec.Command(compiler, "--ast", outputAst, outputPre, outputObj)
 	if out, err := cmdComp.CombinedOutput(); err != nil {
 		pterm.Error.Println(string(out))
 		os.Exit(1)
@@ -109,6 +94,40 @@ func compile(inputFile string) {
 	pterm.Success.Println("Compilation done")
 }
 
+// plsaArgs has plsa preprocess inputFile itself, keep the preprocessed
+// source in outputPre for the compiler, and write the checked
+// tree to outputAst so the compiler need not parse again. It points plsa at
+// a per-user result cache, so checking an unchanged file again is skipped.
+// Without a usable cache directory plsa runs uncached.
+func plsaArgs(inputFile, outputPre, outputAst string) []string {
+	args := []string{"--preprocess", "--emit-pre", outputPre, "--emit-ast", outputAst, "--fold"}
+	dir, err := os.UserCacheDir()
+	if err != nil {
+		return append(args, inputFile)
+	}
+	dir = filepath.Join(dir, "vira-lang", "plsa")
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		return append(args, inputFile)
+	}
+	return append(args, "--cache-dir", dir, inputFile)
+}
+
+// preprocessAndCheck runs plsa with the preprocessor built in, so a source is
+// preprocessed and checked by one process with nothing piped in between.
+// Errors point into the original file or the include they are in. On failure
+// it returns plsa's combined output.
+func preprocessAndCheck(inputFile, outputPre, outputAst string) (string, error) {
+	plsa := filepath.Join(binPath, "plsa")
+	if runtime.GOOS == "windows" {
+		plsa += ".exe"
+	}
+	out, err := exec.Command(plsa, plsaArgs(inputFile, outputPre, outputAst)...).CombinedOutput()
+	if err != nil {
+		return string(out), err
+	}
+	return "", nil
+}
+
 func update() {
 	pterm.DefaultSection.Println("Updating Vira")
 	updater := filepath.Join(binPath, "updater")
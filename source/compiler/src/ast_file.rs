@@ -0,0 +1,110 @@
+// Reader for the tree plsa writes with --emit-ast, so the compiler does not
+// lex and parse the source a second time. The layout is described at
+// AstFile in source/plsa/main.cpp; every section is a little-endian array
+// read in place from the one buffer the file is loaded into.
+use std::fs;
+use std::io::{self, Error, ErrorKind};
+
+const MAGIC: &[u8; 4] = b"VAST";
+const VERSION: u32 = 2;
+const HEADER_WORDS: usize = 9;
+
+// Node kinds, in the order of plsa's ASTType.
+pub const PROGRAM: u8 = 0;
+pub const FUNCTION: u8 = 1;
+pub const RETURN_STMT: u8 = 2;
+pub const BINARY_OP: u8 = 3;
+pub const NUMBER_LITERAL: u8 = 4;
+pub const IDENTIFIER: u8 = 5;
+
+pub struct AstFile {
+    data: Vec<u8>,
+    nodes: usize,
+    symbols: usize,
+    payloads_at: usize,
+    ends_at: usize,
+    offsets_at: usize,
+    starts_at: usize,
+    strings_at: usize,
+}
+
+fn invalid(message: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, message.to_string())
+}
+
+impl AstFile {
+    pub fn read(path: &str) -> io::Result<AstFile> {
+        let data = fs::read(path)?;
+        if data.len() < HEADER_WORDS * 4 || &data[0..4] != MAGIC {
+            return Err(invalid("not a plsa AST file"));
+        }
+        let header = |i: usize| u32::from_le_bytes([data[i * 4], data[i * 4 + 1], data[i * 4 + 2], data[i * 4 + 3]]);
+        if header(1) != VERSION {
+            return Err(invalid("unsupported AST file version"));
+        }
+        // header(2) holds flags, e.g. whether plsa folded constants; the
+        // tree reads the same either way.
+        let nodes = header(3) as usize;
+        let symbols = header(4) as usize;
+        let string_bytes = header(5) as usize;
+        let kinds_at = HEADER_WORDS * 4;
+        let payloads_at = kinds_at + (nodes + 3) / 4 * 4;
+        let ends_at = payloads_at + nodes * 4;
+        let offsets_at = ends_at + nodes * 4;
+        let starts_at = offsets_at + nodes * 4;
+        let strings_at = starts_at + (symbols + 1) * 4;
+        if data.len() != strings_at + string_bytes {
+            return Err(invalid("truncated AST file"));
+        }
+        let file = AstFile { data, nodes, symbols, payloads_at, ends_at, offsets_at, starts_at, strings_at };
+        if file.word(file.starts_at, symbols) as usize != string_bytes {
+            return Err(invalid("corrupt AST string table"));
+        }
+        Ok(file)
+    }
+
+    fn word(&self, base: usize, index: usize) -> u32 {
+        let at = base + index * 4;
+        u32::from_le_bytes([self.data[at], self.data[at + 1], self.data[at + 2], self.data[at + 3]])
+    }
+
+    pub fn len(&self) -> usize {
+        self.nodes
+    }
+
+    pub fn kind(&self, node: usize) -> u8 {
+        self.data[HEADER_WORDS * 4 + node]
+    }
+
+    // Node node's descendants are node + 1 .. subtree_end(node); each
+    // child's next sibling starts at that child's subtree_end.
+    pub fn subtree_end(&self, node: usize) -> usize {
+        self.word(self.ends_at, node) as usize
+    }
+
+    pub fn offset(&self, node: usize) -> u32 {
+        self.word(self.offsets_at, node)
+    }
+
+    pub fn children(&self, node: usize) -> Vec<usize> {
+        let mut out = Vec::new();
+        let mut child = node + 1;
+        while child < self.subtree_end(node) {
+            out.push(child);
+            child = self.subtree_end(child);
+        }
+        out
+    }
+
+    // The node's symbol text, e.g. a name, a number's digits or an
+    // operator's spelling.
+    pub fn text(&self, node: usize) -> &str {
+        let symbol = self.word(self.payloads_at, node) as usize;
+        if symbol >= self.symbols {
+            return "";
+        }
+        let start = self.strings_at + self.word(self.starts_at, symbol) as usize;
+        let end = self.strings_at + self.word(self.starts_at, symbol + 1) as usize;
+        std::str::from_utf8(&self.data[start..end]).unwrap_or("")
+    }
+}
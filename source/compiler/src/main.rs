@@ -13,6 +13,9 @@ use cranelift_module::{Linkage, Module};
 use cranelift_object::{ObjectBuilder, ObjectModule};
 use target_lexicon::Triple;
 
+mod ast_file;
+use ast_file::AstFile;
+
 #[derive(Debug, PartialEq, Clone)]
 enum Token {
     Identifier(String),
@@ -198,6 +201,63 @@ impl Parser {
     }
 }
 
+// Something in plsa's tree the compiler cannot build code for, at a byte
+// offset into the preprocessed source when it belongs to a node.
+struct AstError {
+    message: String,
+    offset: Option<u32>,
+}
+
+impl AstError {
+    // The message with a line and column in source, in plsa's format, if
+    // the source can be read.
+    fn describe(&self, source: &str) -> String {
+        let (Some(offset), Ok(text)) = (self.offset, fs::read(source)) else {
+            return self.message.clone();
+        };
+        let before = &text[..(offset as usize).min(text.len())];
+        let line = before.iter().filter(|&&b| b == b'\n').count() + 1;
+        let column = before.len() - before.iter().rposition(|&b| b == b'\n').map_or(0, |i| i + 1) + 1;
+        format!("{} at line {}, column {}", self.message, line, column)
+    }
+}
+
+// Builds the tree from the one plsa already checked. Only the constructs
+// the code generator handles are converted, as with the parser above;
+// anything else is an error rather than a crash, since plsa accepts more
+// than the compiler can build yet.
+fn ast_from_file(file: &AstFile, node: usize) -> Result<ASTNode, AstError> {
+    let children = file.children(node);
+    let fail = |message: String| AstError { message, offset: Some(file.offset(node)) };
+    let child = |i: usize| match children.get(i) {
+        Some(&c) => ast_from_file(file, c),
+        None => Err(fail("Malformed AST node".to_string())),
+    };
+    let all = || children.iter().map(|&c| ast_from_file(file, c)).collect::<Result<Vec<_>, _>>();
+    Ok(match file.kind(node) {
+        ast_file::PROGRAM => ASTNode::Program(all()?),
+        ast_file::FUNCTION => ASTNode::Function(file.text(node).to_string(), all()?),
+        ast_file::RETURN_STMT => ASTNode::Return(Box::new(child(0)?)),
+        ast_file::BINARY_OP => {
+            let op = file.text(node);
+            match op {
+                "+" | "-" | "*" | "/" => ASTNode::BinaryOp(
+                    op.chars().next().unwrap(),
+                    Box::new(child(0)?),
+                    Box::new(child(1)?),
+                ),
+                _ => return Err(fail(format!("Unsupported operator: {}", op))),
+            }
+        }
+        ast_file::NUMBER_LITERAL => {
+            let digits = file.text(node);
+            ASTNode::Number(digits.parse().map_err(|_| fail(format!("Number out of range: {}", digits)))?)
+        }
+        ast_file::IDENTIFIER => ASTNode::Identifier(file.text(node).to_string()),
+        _ => return Err(fail("Unsupported statement".to_string())),
+    })
+}
+
 struct CodeGenerator {
     module: ObjectModule,
     variables: HashMap<String, Variable>,
@@ -299,16 +359,42 @@ impl CodeGenerator {
 }
 
 fn main() -> io::Result<()> {
-    let args: Vec<String> = env::args().collect();
+    let mut args: Vec<String> = env::args().collect();
+    // --ast takes the tree plsa wrote with --emit-ast instead of parsing
+    // the input again.
+    let mut ast_path = None;
+    if args.len() >= 3 && args[1] == "--ast" {
+        ast_path = Some(args.remove(2));
+        args.remove(1);
+    }
     if args.len() != 3 {
-        println!("Usage: compiler <input.vira> <output.o>");
+        println!("Usage: compiler [--ast <input.ast>] <input.vira> <output.o>");
         return Ok(());
     }
     let input_path = &args[1];
     let mut output_path = args[2].clone();
-    let input = fs::read_to_string(input_path)?;
-    let mut parser = Parser::new(input);
-    let ast = parser.parse();
+    let ast = match ast_path {
+        Some(path) => {
+            let file = AstFile::read(&path)?;
+            let tree = if file.len() == 0 {
+                Err(AstError { message: "Empty AST file".to_string(), offset: None })
+            } else {
+                ast_from_file(&file, 0)
+            };
+            match tree {
+                Ok(ast) => ast,
+                Err(e) => {
+                    eprintln!("Error: {}", e.describe(input_path));
+                    std::process::exit(1);
+                }
+            }
+        }
+        None => {
+            let input = fs::read_to_string(input_path)?;
+            let mut parser = Parser::new(input);
+            parser.parse()
+        }
+    };
     let generator = CodeGenerator::new();
     let obj_bytes = generator.generate(&ast);
     let os = env::consts::OS;
@@ -0,0 +1,258 @@
+// Front-end benchmarks for plsa: generates Vira sources of a chosen shape and
+// size, then times the lexer, the parser and the checker separately.
+//   plsa-bench [--shape NAME] [--size MB] [--reps N] [-j N] [--seed N]
+//              [--depth N] [--terms N] [--emit DIR] [file.vira...]
+// Shapes: functions (many small functions), expressions (long operator
+// chains), strings (long string literals), nesting (deeply nested blocks),
+// mixed (all of them), or all (each in turn, the default). Files given on
+// the command line are benchmarked as they are, instead of generated input.
+// --emit writes the generated sources to DIR and exits, e.g. to train a
+// profile-guided build.
+#define PLSA_NO_MAIN
+// main.cpp's command-line helpers go unused here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "main.cpp"
+#pragma GCC diagnostic pop
+
+#include <random>
+
+namespace {
+
+struct Options {
+    std::string shape = "all";
+    size_t sizeMB = 8;
+    size_t reps = 5;
+    size_t jobs = 1;
+    size_t seed = 1;
+    size_t depth = 64;  // nesting shape: block depth per function
+    size_t terms = 200; // expressions shape: operands per expression
+    std::string emitDir;
+    std::vector<std::string> files;
+};
+
+// Appends functions of one shape to out until it holds at least size bytes.
+// Every shape but strings is valid Vira, so parse and check time is spent on
+// the normal path; the grammar has no string operands yet, so the strings
+// shape exercises the lexer and, past it, error recovery.
+class Generator {
+private:
+    const Options& options;
+    std::mt19937 rng;
+    size_t functions = 0;
+
+    size_t pick(size_t n) { return rng() % n; }
+
+    std::string number() { return std::to_string(pick(100000)); }
+
+    std::string name() { return "f" + std::to_string(functions++); }
+
+    void smallFunction(std::string& out) {
+        out += "int " + name() + "() {\n";
+        out += "    int a = " + number() + ";\n";
+        out += "    int b = a * " + number() + " + " + number() + ";\n";
+        out += "    if (a < b) {\n        a = b - a;\n    } else {\n        b = a;\n    }\n";
+        out += "    while (a > 0) {\n        a = a - " + number() + ";\n    }\n";
+        out += "    for (int i = 0; i < b; i = i + 1) {\n        a = a + i;\n    }\n";
+        out += "    return a + b;\n}\n";
+    }
+
+    void expressionFunction(std::string& out) {
+        static const char* ops[] = {" + ", " - ", " * ", " / ", " < ", " == ", " && ", " || "};
+        out += "int " + name() + "() {\n    int x = " + number() + ";\n    int y = x";
+        for (size_t i = 1; i < options.terms; i++) {
+            out += ops[pick(8)];
+            out += pick(2) ? number() : "x";
+        }
+        out += ";\n    return y;\n}\n";
+    }
+
+    void stringFunction(std::string& out) {
+        out += "int " + name() + "() {\n    return \"";
+        size_t length = 200 + pick(2000);
+        for (size_t i = 0; i < length; i++) {
+            out += static_cast<char>('a' + pick(26));
+            if (pick(64) == 0) {
+                out += "\\n";
+            }
+        }
+        out += "\";\n}\n";
+    }
+
+    void nestedFunction(std::string& out) {
+        out += "int " + name() + "() {\n    int a = " + number() + ";\n";
+        for (size_t d = 0; d < options.depth; d++) {
+            out += std::string(4 + d * 2, ' ');
+            out += d % 3 == 0 ? "if (a) {\n" : d % 3 == 1 ? "while (a) {\n" : "{\n";
+        }
+        out += std::string(4 + options.depth * 2, ' ') + "a = a - 1;\n";
+        for (size_t d = options.depth; d-- > 0;) {
+            out += std::string(4 + d * 2, ' ') + "}\n";
+        }
+        out += "    return a;\n}\n";
+    }
+
+public:
+    Generator(const Options& options, size_t seed) : options(options), rng(static_cast<uint32_t>(seed)) {}
+
+    std::string generate(const std::string& shape, size_t size) {
+        std::string out;
+        out.reserve(size + 65536);
+        while (out.size() < size) {
+            std::string kind = shape;
+            if (shape == "mixed") {
+                static const char* kinds[] = {"functions", "expressions", "strings", "nesting"};
+                kind = kinds[pick(4)];
+            }
+            if (kind == "functions") {
+                smallFunction(out);
+            } else if (kind == "expressions") {
+                expressionFunction(out);
+            } else if (kind == "strings") {
+                stringFunction(out);
+            } else {
+                nestedFunction(out);
+            }
+        }
+        return out;
+    }
+};
+
+template <typename F>
+double bestOf(size_t reps, F&& run) {
+    double best = 1e300;
+    for (size_t i = 0; i < reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+void printRow(const char* phase, double seconds, size_t bytes, double items, const char* unit) {
+    std::printf("  %-12s %9.3f ms %9.1f MB/s %9.2f M %s/s\n", phase, seconds * 1e3, bytes / seconds / 1e6,
+                items / seconds / 1e6, unit);
+}
+
+// Each run starts from a fresh interner, as a real check does, so interning
+// is part of the lexer's time. Parse time includes the lexing the parser
+// drives, in parallel chunks with -j on large inputs; "parse only" takes out
+// the lexing measured inside the same runs.
+void benchmark(const std::string& label, std::string_view text, const Options& options, ThreadPool& pool) {
+    size_t tokens = 0;
+    double lex = bestOf(options.reps, [&] {
+        Interner names;
+        Diagnostics diagnostics(SIZE_MAX);
+        Lexer lexer(text, names, diagnostics);
+        tokens = 0;
+        while (lexer.nextToken().type != TokenType::EOFToken) {
+            tokens++;
+        }
+    });
+
+    double lexInParse = 1e300;
+    double parse = bestOf(options.reps, [&] {
+        Interner names;
+        Arena arena;
+        Diagnostics diagnostics(SIZE_MAX);
+        Stats stats;
+        Parser parser(text, arena, names, diagnostics);
+        parser.collectStats(stats);
+        parser.lexInParallel(pool);
+        parser.parse();
+        lexInParse = std::min(lexInParse, stats.lex.wall);
+    });
+
+    Interner names;
+    Arena arena;
+    Diagnostics parseErrors(SIZE_MAX);
+    Parser parser(text, arena, names, parseErrors);
+    FlatAST ast = flatten(parser.parse(), names);
+    size_t errors = 0;
+    double check = bestOf(options.reps, [&] {
+        Diagnostics diagnostics(SIZE_MAX);
+        SemanticChecker::check(ast, diagnostics, &pool);
+        errors = parseErrors.all().size() + diagnostics.all().size();
+    });
+
+    std::printf("%s: %.2f MB, %zu tokens, %u nodes, %zu errors\n", label.c_str(), text.size() / 1e6, tokens,
+                ast.size(), errors);
+    printRow("lex", lex, text.size(), tokens, "tokens");
+    printRow("parse", parse, text.size(), tokens, "tokens");
+    printRow("parse only", std::max(parse - lexInParse, 1e-9), text.size(), tokens, "tokens");
+    printRow("check", check, text.size(), ast.size(), "nodes");
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    const std::pair<const char*, size_t*> counts[] = {{"--size", &options.sizeMB}, {"--reps", &options.reps},
+                                                      {"-j", &options.jobs},       {"--seed", &options.seed},
+                                                      {"--depth", &options.depth}, {"--terms", &options.terms}};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto count = std::find_if(std::begin(counts), std::end(counts),
+                                  [&](const std::pair<const char*, size_t*>& c) { return arg == c.first; });
+        if (count != std::end(counts)) {
+            *count->second = i + 1 < argc ? parseCount(argv[++i]) : 0;
+            if (*count->second == 0) {
+                return false;
+            }
+        } else if (arg == "--shape" && i + 1 < argc) {
+            options.shape = argv[++i];
+        } else if (arg == "--emit" && i + 1 < argc) {
+            options.emitDir = argv[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            return false;
+        } else {
+            options.files.push_back(arg);
+        }
+    }
+    static const char* shapes[] = {"all", "functions", "expressions", "strings", "nesting", "mixed"};
+    return std::find(std::begin(shapes), std::end(shapes), options.shape) != std::end(shapes);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: plsa-bench [--shape all|functions|expressions|strings|nesting|mixed] [--size MB]\n"
+                     "                  [--reps N] [-j N] [--seed N] [--depth N] [--terms N] [--emit DIR]\n"
+                     "                  [file.vira...]"
+                  << std::endl;
+        return 1;
+    }
+    ThreadPool pool(options.jobs);
+    if (!options.files.empty()) {
+        for (const std::string& path : options.files) {
+            SourceBuffer source;
+            if (!source.open(path.c_str())) {
+                std::cerr << "Could not open file: " << path << std::endl;
+                return 1;
+            }
+            benchmark(path, source.text(), options, pool);
+        }
+        return 0;
+    }
+
+    std::vector<std::string> shapes;
+    if (options.shape == "all") {
+        shapes = {"functions", "expressions", "strings", "nesting", "mixed"};
+    } else {
+        shapes = {options.shape};
+    }
+    for (const std::string& shape : shapes) {
+        std::string text = Generator(options, options.seed).generate(shape, options.sizeMB << 20);
+        if (!options.emitDir.empty()) {
+            std::filesystem::path dir(options.emitDir);
+            std::error_code ec;
+            std::filesystem::create_directories(dir, ec);
+            if (!replaceFile(dir / (shape + ".vira"), text)) {
+                std::cerr << "Could not write " << (dir / (shape + ".vira")).string() << std::endl;
+                return 1;
+            }
+            continue;
+        }
+        benchmark(shape, text, options, pool);
+    }
+    return 0;
+}
@@ -1,304 +1,4591 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
+#include <deque>
 #include <vector>
-#include <map>
-#include <cctype>
+#include <memory_resource>
+#include <algorithm>
+#include <cstdint>
 #include <stdexcept>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <array>
+#include <cstring>
+#include <cctype>
+#include <filesystem>
+#include <list>
+#include <unordered_map>
+#include <chrono>
+#include <ctime>
 
-enum class TokenType {
-    Identifier,
-    Keyword,
-    Number,
-    StringLiteral,
-    Punctuator,
-    EOFToken
-};
+#if defined(PLSA_NO_SIMD)
+#define PLSA_SIMD_SCALAR 1
+#elif defined(__AVX2__)
+#define PLSA_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define PLSA_SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define PLSA_SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define PLSA_SIMD_SCALAR 1
+#endif
 
-struct Token {
-    TokenType type;
-    std::string value;
-    size_t line;
-    size_t column;
-};
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-class Lexer {
+// Read-only view of a whole input file. Regular files are memory-mapped so the
+// lexer works straight from the page cache; anything that cannot be mapped
+// (pipes, character devices, empty files) is read into an owned string.
+class SourceBuffer {
 private:
-    std::string input;
-    size_t position;
-    size_t line;
-    size_t column;
+    std::string owned;
+    const char* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    bool mapped = false;
+#endif
 
-public:
-    Lexer(const std::string& src) : input(src), position(0), line(1), column(1) {}
+    bool readFallback(const char* path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        owned.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        data = owned.data();
+        length = owned.size();
+        return true;
+    }
 
-    Token nextToken() {
-        skipWhitespace();
-        if (position >= input.size()) {
-            return {TokenType::EOFToken, "", line, column};
+    bool map(const char* path) {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (GetFileType(fileHandle) != FILE_TYPE_DISK || !GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0) {
+            return false;
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr) {
+            return false;
+        }
+        void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr) {
+            return false;
+        }
+        data = static_cast<const char*>(view);
+        length = static_cast<size_t>(size.QuadPart);
+        return true;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            ::close(fd);
+            return false;
         }
+        void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps its own reference to the file
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        madvise(view, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+        data = static_cast<const char*>(view);
+        length = static_cast<size_t>(st.st_size);
+        mapped = true;
+        return true;
+#endif
+    }
 
-        char ch = currentChar();
-        if (isalpha(ch) || ch == '_') {
-            return lexIdentifierOrKeyword();
-        } else if (isdigit(ch)) {
-            return lexNumber();
-        } else if (ch == '"') {
-            return lexString();
-        } else if (std::string("+-*/=();{}[]<>,&|!").find(ch) != std::string::npos) {
-            advance();
-            return {TokenType::Punctuator, std::string(1, ch), line, column - 1};
-        } else {
-            throw std::runtime_error("Unexpected character: " + std::string(1, ch));
+    void release() {
+#ifdef _WIN32
+        if (mappingHandle != nullptr && data != nullptr) {
+            UnmapViewOfFile(data);
         }
+        if (mappingHandle != nullptr) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped) {
+            munmap(const_cast<char*>(data), length);
+        }
+        mapped = false;
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+public:
+    SourceBuffer() = default;
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer() { release(); }
+
+    bool open(const char* path) {
+        release();
+        if (map(path)) {
+            return true;
+        }
+        release();
+        return readFallback(path);
     }
 
+    std::string_view text() const {
+        return std::string_view(data, length);
+    }
+};
+
+// Bump allocator that owns every node of one translation unit. Memory is
+// handed out from large chunks and released all at once when the arena goes
+// away; deallocate() is a no-op, so nothing allocated from it (nodes, their
+// child vectors) ever needs its destructor run.
+class Arena : public std::pmr::memory_resource {
 private:
-    char currentChar() const {
-        return input[position];
+    static constexpr size_t ChunkSize = 64 * 1024;
+
+    struct Chunk {
+        Chunk* next;
+    };
+
+    Chunk* chunks = nullptr;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t reserved = 0;
+    size_t used = 0;
+
+    void grow(size_t minBytes) {
+        size_t size = std::max(ChunkSize, minBytes + sizeof(Chunk) + alignof(std::max_align_t));
+        Chunk* chunk = static_cast<Chunk*>(::operator new(size));
+        chunk->next = chunks;
+        chunks = chunk;
+        cursor = reinterpret_cast<char*>(chunk) + sizeof(Chunk);
+        limit = reinterpret_cast<char*>(chunk) + size;
+        reserved += size;
     }
 
-    void advance() {
-        if (currentChar() == '\n') {
-            line++;
-            column = 1;
-        } else {
-            column++;
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (cursor == nullptr || aligned + bytes > reinterpret_cast<uintptr_t>(limit)) {
+            grow(bytes + alignment);
+            aligned = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
         }
-        position++;
+        cursor = reinterpret_cast<char*>(aligned + bytes);
+        used += bytes;
+        return reinterpret_cast<void*>(aligned);
     }
 
-    void skipWhitespace() {
-        while (position < input.size() && isspace(currentChar())) {
-            advance();
-        }
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
     }
 
-    Token lexIdentifierOrKeyword() {
-        std::string id;
-        size_t start_col = column;
-        while (position < input.size() && (isalnum(currentChar()) || currentChar() == '_')) {
-            id += currentChar();
-            advance();
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        while (chunks) {
+            Chunk* next = chunks->next;
+            ::operator delete(chunks);
+            chunks = next;
         }
-        TokenType type = (id == "int" || id == "return" || id == "if" || id == "else" || id == "while" || id == "for")
-                         ? TokenType::Keyword : TokenType::Identifier;
-        return {type, id, line, start_col};
     }
 
-    Token lexNumber() {
-        std::string num;
-        size_t start_col = column;
-        while (position < input.size() && isdigit(currentChar())) {
-            num += currentChar();
-            advance();
+    std::string_view copy(std::string_view text) {
+        char* mem = static_cast<char*>(allocate(text.size() ? text.size() : 1, 1));
+        std::copy(text.begin(), text.end(), mem);
+        return std::string_view(mem, text.size());
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        void* mem = allocate(sizeof(T), alignof(T));
+        return new (mem) T(std::forward<Args>(args)...);
+    }
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const { return reserved; }
+};
+
+// Bounded read window over a stream such as stdin, for input that is still
+// being produced (e.g. piped from the preprocessor). The lexer only calls
+// refill() when it runs off the end of the window; everything before the
+// token it is currently scanning is dropped, so the window stays at
+// WindowSize unless a single token is longer than that.
+class StreamSource {
+private:
+    static constexpr size_t WindowSize = 64 * 1024;
+
+    FILE* file;
+    std::vector<char> buffer;
+    size_t filled = 0;
+    bool eof = false;
+
+public:
+    explicit StreamSource(FILE* file) : file(file), buffer(WindowSize) {}
+    StreamSource(const StreamSource&) = delete;
+    StreamSource& operator=(const StreamSource&) = delete;
+
+    // Discards [0, keepFrom) and tries to read more after the retained
+    // tail. The window is compacted even when nothing more arrives, so the
+    // caller must always rebase onto window(). Returns false once the
+    // stream is exhausted.
+    bool refill(size_t keepFrom) {
+        size_t kept = filled - keepFrom;
+        if (keepFrom > 0) {
+            std::copy(buffer.begin() + keepFrom, buffer.begin() + filled, buffer.begin());
         }
-        return {TokenType::Number, num, line, start_col};
+        filled = kept;
+        if (eof) {
+            return false;
+        }
+        if (kept == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+        size_t n = std::fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+        if (n == 0) {
+            eof = true;
+            return false;
+        }
+        filled += n;
+        return true;
     }
 
-    Token lexString() {
-        advance(); // skip opening "
-        std::string s;
-        size_t start_col = column;
-        while (position < input.size() && currentChar() != '"') {
-            s += currentChar();
-            advance();
+    std::string_view window() const {
+        return std::string_view(buffer.data(), filled);
+    }
+
+    // Reads to the end of the stream without discarding anything, for
+    // callers that need the whole input at once.
+    std::string_view readAll() {
+        while (refill(0)) {
         }
-        advance(); // skip closing "
-        return {TokenType::StringLiteral, s, line, start_col};
+        return window();
     }
 };
 
-enum class ASTType {
-    Program,
-    Function,
-    ReturnStmt,
-    BinaryOp,
-    NumberLiteral,
-    Identifier
+using SymbolId = uint32_t;
+
+enum class TokenType : uint8_t {
+    Identifier,
+    Keyword,
+    Number,
+    StringLiteral,
+    Punctuator,
+    EOFToken
 };
 
-struct ASTNode {
-    ASTType type;
-    std::string value; // for identifiers, operators, etc.
-    std::vector<ASTNode*> children;
-    ~ASTNode() {
-        for (auto child : children) {
-            delete child;
+// Operators and other punctuation. The one-byte kinds come first, in the
+// order of CharClass::punctuators; see Ops for the spellings. The lexer tags
+// each punctuator token with its kind so the parser can dispatch on an enum
+// instead of comparing spellings.
+enum class OpKind : uint8_t {
+    None,
+    Plus, Minus, Star, Slash, Assign,
+    LParen, RParen, Semicolon, LBrace, RBrace, LBracket, RBracket,
+    Less, Greater, Comma, Amp, Pipe, Bang,
+    EqualEqual, NotEqual, LessEqual, GreaterEqual, AndAnd, OrOr,
+    Count
+};
+
+// In the order of Keywords::words.
+enum class Keyword : uint8_t {
+    None,
+    Int, Return, If, Else, While, For
+};
+
+// Tokens are 16 bytes and hold no pointers: the text of identifiers,
+// numbers and string literals (decoded) lives in the Interner under symbol,
+// and keywords and punctuators are fully described by their sub-kind.
+// offset is the byte offset of the token's first character in the whole
+// input (see LineTable) and length the number of source bytes it spans.
+struct Token {
+    uint32_t offset;
+    uint32_t length;
+    SymbolId symbol; // 0 for keywords, punctuators and end of input
+    TokenType type;
+    uint8_t sub;     // OpKind for punctuators, Keyword for keywords, else 0
+
+    OpKind op() const { return type == TokenType::Punctuator ? static_cast<OpKind>(sub) : OpKind::None; }
+    Keyword keyword() const { return type == TokenType::Keyword ? static_cast<Keyword>(sub) : Keyword::None; }
+};
+
+static_assert(sizeof(Token) == 16, "Token should stay four to a cache line");
+
+// Byte classes for the lexer, fixed at compile time. Unlike <cctype> these
+// do not depend on the locale and cost one load per classification.
+namespace CharClass {
+enum : uint8_t {
+    Space = 1 << 0,
+    IdentStart = 1 << 1,
+    Digit = 1 << 2,
+    Punct = 1 << 3,
+    Ident = IdentStart | Digit,
+};
+
+constexpr std::string_view punctuators = "+-*/=();{}[]<>,&|!";
+
+constexpr std::array<uint8_t, 256> makeTable() {
+    std::array<uint8_t, 256> table{};
+    for (char c : std::string_view(" \t\n\v\f\r")) {
+        table[static_cast<unsigned char>(c)] |= Space;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        table[c] |= IdentStart;
+        table[c - 'a' + 'A'] |= IdentStart;
+    }
+    table['_'] |= IdentStart;
+    for (int c = '0'; c <= '9'; c++) {
+        table[c] |= Digit;
+    }
+    for (char c : punctuators) {
+        table[static_cast<unsigned char>(c)] |= Punct;
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> table = makeTable();
+
+constexpr std::array<OpKind, 256> makeOps() {
+    std::array<OpKind, 256> ops{};
+    for (size_t i = 0; i < punctuators.size(); i++) {
+        ops[static_cast<unsigned char>(punctuators[i])] = static_cast<OpKind>(i + 1);
+    }
+    return ops;
+}
+
+constexpr std::array<OpKind, 256> ops = makeOps();
+
+inline bool is(char c, uint8_t mask) {
+    return (table[static_cast<unsigned char>(c)] & mask) != 0;
+}
+
+constexpr OpKind op(char c) {
+    return ops[static_cast<unsigned char>(c)];
+}
+}
+
+// Spellings of every OpKind. A two-byte operator is its one-byte first half
+// extended by one more byte; the lexer takes the longest match.
+namespace Ops {
+constexpr std::string_view spellings[] = {
+    "",
+    "+", "-", "*", "/", "=",
+    "(", ")", ";", "{", "}", "[", "]",
+    "<", ">", ",", "&", "|", "!",
+    "==", "!=", "<=", ">=", "&&", "||",
+};
+static_assert(std::size(spellings) == static_cast<size_t>(OpKind::Count), "Ops::spellings must cover OpKind");
+
+constexpr bool matchesPunctuators() {
+    for (size_t i = 0; i < CharClass::punctuators.size(); i++) {
+        if (spellings[i + 1] != CharClass::punctuators.substr(i, 1)) {
+            return false;
         }
     }
+    return spellings[CharClass::punctuators.size() + 1].size() == 2;
+}
+static_assert(matchesPunctuators(), "one-byte OpKinds must follow CharClass::punctuators");
+
+inline std::string_view spelling(OpKind op) {
+    return spellings[static_cast<size_t>(op)];
+}
+
+// For each one-byte kind, the byte that extends it to a two-byte operator
+// and the resulting kind. Each currently has at most one extension.
+struct Extension {
+    char next;
+    OpKind kind;
 };
 
-class Parser {
-private:
-    Lexer lexer;
-    Token currentToken;
+constexpr std::array<Extension, static_cast<size_t>(OpKind::Count)> makeExtensions() {
+    std::array<Extension, static_cast<size_t>(OpKind::Count)> ext{};
+    for (size_t i = CharClass::punctuators.size() + 1; i < std::size(spellings); i++) {
+        ext[static_cast<size_t>(CharClass::op(spellings[i][0]))] = {spellings[i][1], static_cast<OpKind>(i)};
+    }
+    return ext;
+}
 
-    void eat(TokenType expectedType, const std::string& expectedValue = "") {
-        if (currentToken.type == expectedType &&
-            (expectedValue.empty() || currentToken.value == expectedValue)) {
-            currentToken = lexer.nextToken();
-        } else {
-            throw std::runtime_error("Syntax error at line " + std::to_string(currentToken.line) +
-                                     ", column " + std::to_string(currentToken.column));
+constexpr std::array<Extension, static_cast<size_t>(OpKind::Count)> extensions = makeExtensions();
+
+constexpr bool extensionsDistinct() {
+    size_t count = 0;
+    for (const Extension& ext : extensions) {
+        count += ext.kind != OpKind::None;
+    }
+    return count == std::size(spellings) - CharClass::punctuators.size() - 1;
+}
+static_assert(extensionsDistinct(), "two two-byte operators share a first byte; Ops::extend needs a wider table");
+
+// The two-byte operator that first followed by next spells, or None.
+inline OpKind extend(OpKind first, char next) {
+    const Extension& ext = extensions[static_cast<size_t>(first)];
+    return ext.next == next && next != '\0' ? ext.kind : OpKind::None;
+}
+}
+
+// Vira keywords, looked up with a perfect hash over (length, first byte,
+// last byte). To add a keyword, append it to `words`; the static_assert
+// below fails if it collides with an existing one, in which case the hash
+// or table size needs adjusting.
+namespace Keywords {
+constexpr std::string_view words[] = {"int", "return", "if", "else", "while", "for"};
+constexpr size_t TableSize = 32;
+
+constexpr size_t hash(std::string_view w) {
+    return (w.size() + static_cast<unsigned char>(w.front()) + static_cast<unsigned char>(w.back())) % TableSize;
+}
+
+// Slot value is index + 1 into words, 0 for an empty slot.
+constexpr std::array<uint8_t, TableSize> makeSlots() {
+    std::array<uint8_t, TableSize> slots{};
+    for (size_t i = 0; i < std::size(words); i++) {
+        slots[hash(words[i])] = static_cast<uint8_t>(i + 1);
+    }
+    return slots;
+}
+
+constexpr std::array<uint8_t, TableSize> slots = makeSlots();
+
+constexpr bool collisionFree() {
+    for (size_t i = 0; i < std::size(words); i++) {
+        if (slots[hash(words[i])] != i + 1) {
+            return false;
         }
     }
+    return true;
+}
+static_assert(collisionFree(), "keyword hash collision; adjust Keywords::hash");
 
-    ASTNode* parsePrimary() {
-        if (currentToken.type == TokenType::Number) {
-            ASTNode* node = new ASTNode{ASTType::NumberLiteral, currentToken.value};
-            eat(TokenType::Number);
-            return node;
-        } else if (currentToken.type == TokenType::Identifier) {
-            ASTNode* node = new ASTNode{ASTType::Identifier, currentToken.value};
-            eat(TokenType::Identifier);
-            return node;
-        } else {
-            throw std::runtime_error("Unexpected token in primary");
+static_assert(std::size(words) == static_cast<size_t>(Keyword::For), "Keyword must list every word");
+
+inline Keyword lookup(std::string_view w) {
+    uint8_t slot = slots[hash(w)];
+    return slot != 0 && words[slot - 1] == w ? static_cast<Keyword>(slot) : Keyword::None;
+}
+
+inline std::string_view spelling(Keyword k) {
+    return words[static_cast<size_t>(k) - 1];
+}
+}
+
+// Vectorized scanning of byte runs for the lexer: each span function returns
+// how many leading bytes of [p, p + n) belong to its class, testing Width
+// bytes per step and finishing the tail with the CharClass table. The
+// instruction set is picked at compile time (AVX2, SSE2 or NEON); build with
+// PLSA_NO_SIMD to force the scalar path.
+namespace Scan {
+#if PLSA_SIMD_AVX2
+constexpr size_t Width = 32;
+constexpr unsigned BitsPerByte = 1;
+using Block = __m256i;
+inline Block load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Block splat(char c) { return _mm256_set1_epi8(c); }
+inline Block eq(Block a, char c) { return _mm256_cmpeq_epi8(a, splat(c)); }
+inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+inline Block inRange(Block a, char lo, char hi) {
+    Block x = _mm256_sub_epi8(a, splat(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, splat(static_cast<char>(hi - lo))), x);
+}
+inline uint64_t bits(Block b) { return static_cast<uint32_t>(_mm256_movemask_epi8(b)); }
+#elif PLSA_SIMD_SSE2
+constexpr size_t Width = 16;
+constexpr unsigned BitsPerByte = 1;
+using Block = __m128i;
+inline Block load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Block splat(char c) { return _mm_set1_epi8(c); }
+inline Block eq(Block a, char c) { return _mm_cmpeq_epi8(a, splat(c)); }
+inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+inline Block inRange(Block a, char lo, char hi) {
+    Block x = _mm_sub_epi8(a, splat(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, splat(static_cast<char>(hi - lo))), x);
+}
+inline uint64_t bits(Block b) { return static_cast<uint32_t>(_mm_movemask_epi8(b)); }
+#elif PLSA_SIMD_NEON
+constexpr size_t Width = 16;
+constexpr unsigned BitsPerByte = 4; // NEON has no movemask; narrow to a nibble per byte
+using Block = uint8x16_t;
+inline Block load(const char* p) { return vld1q_u8(reinterpret_cast<const uint8_t*>(p)); }
+inline Block splat(char c) { return vdupq_n_u8(static_cast<uint8_t>(c)); }
+inline Block eq(Block a, char c) { return vceqq_u8(a, splat(c)); }
+inline Block either(Block a, Block b) { return vorrq_u8(a, b); }
+inline Block inRange(Block a, char lo, char hi) {
+    return vcleq_u8(vsubq_u8(a, splat(lo)), splat(static_cast<char>(hi - lo)));
+}
+inline uint64_t bits(Block b) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(b), 4)), 0);
+}
+#endif
+
+#if !PLSA_SIMD_SCALAR
+constexpr uint64_t AllBits = Width * BitsPerByte == 64 ? ~uint64_t(0) : (uint64_t(1) << (Width * BitsPerByte)) - 1;
+
+inline unsigned countTrailingZeros(uint64_t x) {
+    return static_cast<unsigned>(__builtin_ctzll(x));
+}
+
+template <typename Match>
+inline size_t spanBlocks(const char* p, size_t n, size_t& i, Match match) {
+    for (; i + Width <= n; i += Width) {
+        uint64_t m = bits(match(load(p + i)));
+        if (m != AllBits) {
+            return i + countTrailingZeros(~m) / BitsPerByte;
         }
     }
+    return SIZE_MAX;
+}
+#endif
 
-    ASTNode* parseExpr() {
-        ASTNode* node = parsePrimary();
-        while (currentToken.type == TokenType::Punctuator &&
-               (currentToken.value == "+" || currentToken.value == "-" ||
-                currentToken.value == "*" || currentToken.value == "/")) {
-            std::string op = currentToken.value;
-            eat(TokenType::Punctuator, op);
-            ASTNode* right = parsePrimary();
-            ASTNode* newNode = new ASTNode{ASTType::BinaryOp, op};
-            newNode->children.push_back(node);
-            newNode->children.push_back(right);
-            node = newNode;
+template <typename Match>
+inline size_t span(const char* p, size_t n, uint8_t scalarClass, [[maybe_unused]] Match match) {
+    size_t i = 0;
+#if !PLSA_SIMD_SCALAR
+    size_t stop = spanBlocks(p, n, i, match);
+    if (stop != SIZE_MAX) {
+        return stop;
+    }
+#endif
+    while (i < n && CharClass::is(p[i], scalarClass)) {
+        i++;
+    }
+    return i;
+}
+}
+
+#if PLSA_SIMD_SCALAR
+#define PLSA_MATCH(expr) nullptr
+#else
+#define PLSA_MATCH(expr) [](Scan::Block b) { return expr; }
+#endif
+
+namespace Scan {
+inline size_t whitespace(const char* p, size_t n) {
+    return span(p, n, CharClass::Space, PLSA_MATCH(either(eq(b, ' '), inRange(b, '\t', '\r'))));
+}
+
+inline size_t identifier(const char* p, size_t n) {
+    return span(p, n, CharClass::Ident, PLSA_MATCH(either(
+        either(inRange(b, 'a', 'z'), inRange(b, 'A', 'Z')),
+        either(inRange(b, '0', '9'), eq(b, '_')))));
+}
+
+inline size_t digits(const char* p, size_t n) {
+    return span(p, n, CharClass::Digit, PLSA_MATCH(inRange(b, '0', '9')));
+}
+
+// String body: everything up to the closing quote or an escape.
+inline size_t stringBody(const char* p, size_t n) {
+    size_t i = 0;
+#if !PLSA_SIMD_SCALAR
+    for (; i + Width <= n; i += Width) {
+        Block b = load(p + i);
+        uint64_t stop = bits(either(eq(b, '"'), eq(b, '\\')));
+        if (stop != 0) {
+            return i + countTrailingZeros(stop) / BitsPerByte;
         }
-        return node;
     }
+#endif
+    while (i < n && p[i] != '"' && p[i] != '\\') {
+        i++;
+    }
+    return i;
+}
 
-    ASTNode* parseStatement() {
-        if (currentToken.type == TokenType::Keyword && currentToken.value == "return") {
-            eat(TokenType::Keyword, "return");
-            ASTNode* expr = parseExpr();
-            eat(TokenType::Punctuator, ";");
-            ASTNode* node = new ASTNode{ASTType::ReturnStmt, ""};
-            node->children.push_back(expr);
-            return node;
-        } else {
-            throw std::runtime_error("Unsupported statement");
+// Calls fn(i) with the index of every '\n' in [p, p + n), in order.
+template <typename Fn>
+inline void forEachNewline(const char* p, size_t n, Fn fn) {
+    size_t i = 0;
+#if !PLSA_SIMD_SCALAR
+    for (; i + Width <= n; i += Width) {
+        uint64_t m = bits(eq(load(p + i), '\n'));
+        while (m != 0) {
+            unsigned bit = countTrailingZeros(m);
+            fn(i + bit / BitsPerByte);
+            m &= ~((uint64_t(1) << (bit + BitsPerByte - 1) << 1) - 1); // drop this byte's bits
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (p[i] == '\n') {
+            fn(i);
         }
     }
+}
+}
 
-    ASTNode* parseFunction() {
-        eat(TokenType::Keyword, "int");
-        std::string name = currentToken.value;
-        eat(TokenType::Identifier);
-        eat(TokenType::Punctuator, "(");
-        eat(TokenType::Punctuator, ")");
-        eat(TokenType::Punctuator, "{");
-        ASTNode* node = new ASTNode{ASTType::Function, name};
-        while (currentToken.type != TokenType::Punctuator || currentToken.value != "}") {
-            node->children.push_back(parseStatement());
-        }
-        eat(TokenType::Punctuator, "}");
-        return node;
+#undef PLSA_MATCH
+
+// Byte offsets of every newline in the input. The lexer tracks nothing but
+// offsets; line and column numbers are derived here when a diagnostic needs
+// them. An in-memory buffer is indexed on first use (thread-safely, since
+// checker threads may report at the same time). A stream has to be indexed
+// block by block as it arrives, because the window is gone by then.
+class LineTable {
+private:
+    mutable std::vector<uint32_t> newlines;
+    mutable std::once_flag indexed;
+    std::string_view deferred;
+
+    static void scan(std::vector<uint32_t>& out, size_t base, const char* p, size_t n) {
+        Scan::forEachNewline(p, n, [&](size_t i) { out.push_back(static_cast<uint32_t>(base + i)); });
     }
 
 public:
-    Parser(const std::string& src) : lexer(src), currentToken(lexer.nextToken()) {}
+    struct Location {
+        size_t line;
+        size_t column;
+    };
 
-    ASTNode* parse() {
-        ASTNode* program = new ASTNode{ASTType::Program, ""};
-        while (currentToken.type != TokenType::EOFToken) {
-            program->children.push_back(parseFunction());
-        }
-        return program;
+    void indexLazily(std::string_view text) { deferred = text; }
+
+    void append(size_t base, const char* p, size_t n) { scan(newlines, base, p, n); }
+
+    Location locate(size_t offset) const {
+        std::call_once(indexed, [this] { scan(newlines, 0, deferred.data(), deferred.size()); });
+        size_t before = std::lower_bound(newlines.begin(), newlines.end(), offset) - newlines.begin();
+        size_t lineStart = before == 0 ? 0 : newlines[before - 1] + 1;
+        return {before + 1, offset - lineStart + 1};
     }
 };
 
-class SemanticChecker {
+// Collects the errors of one translation unit instead of stopping at the
+// first. Each diagnostic keeps the byte offset it refers to, which is only
+// turned into a line and column when results are printed. Reports past the
+// limit are dropped and only counted.
+struct Diagnostic {
+    uint32_t offset;
+    std::string message;
+};
+
+class Diagnostics {
 private:
-    std::map<std::string, std::string> symbolTable; // Simple type table
-
-    void checkExpr(ASTNode* node) {
-        if (node->type == ASTType::NumberLiteral) {
-            // OK
-        } else if (node->type == ASTType::Identifier) {
-            if (symbolTable.find(node->value) == symbolTable.end()) {
-                throw std::runtime_error("Undefined identifier: " + node->value);
-            }
-        } else if (node->type == ASTType::BinaryOp) {
-            if (node->children.size() != 2) {
-                throw std::runtime_error("Binary op needs two children");
-            }
-            checkExpr(node->children[0]);
-            checkExpr(node->children[1]);
-            // Type checking could be added here
+    std::vector<Diagnostic> items;
+    size_t limit;
+    size_t dropped = 0;
+
+public:
+    static constexpr size_t DefaultLimit = 100;
+
+    explicit Diagnostics(size_t limit = DefaultLimit) : limit(limit) {}
+
+    void report(uint32_t offset, std::string message) {
+        if (items.size() < limit) {
+            items.push_back({offset, std::move(message)});
         } else {
-            throw std::runtime_error("Unsupported expr in semantic check");
+            dropped++;
         }
     }
 
-    void checkStatement(ASTNode* node) {
-        if (node->type == ASTType::ReturnStmt) {
-            if (node->children.empty()) {
-                throw std::runtime_error("Return statement missing expression");
-            }
-            checkExpr(node->children[0]);
-        } else {
-            throw std::runtime_error("Unsupported statement in semantic check");
+    // Appends another collector's reports after this one's, in order.
+    void append(const Diagnostics& other) {
+        for (const Diagnostic& d : other.items) {
+            report(d.offset, d.message);
         }
+        dropped += other.dropped;
+    }
+
+    // Puts reports from separate passes (lexer, parser, checker) into
+    // source order; reports at the same offset keep their relative order.
+    void sort() {
+        std::stable_sort(items.begin(), items.end(),
+                         [](const Diagnostic& a, const Diagnostic& b) { return a.offset < b.offset; });
     }
 
-    void checkFunction(ASTNode* node) {
-        if (node->type != ASTType::Function) {
-            throw std::runtime_error("Expected function");
+    bool full() const { return items.size() >= limit; }
+    bool empty() const { return items.empty(); }
+    size_t droppedCount() const { return dropped; }
+    size_t maximum() const { return limit; }
+    const std::vector<Diagnostic>& all() const { return items; }
+};
+
+// Maps each distinct identifier or literal spelling of a translation unit to
+// a dense SymbolId, so later stages compare and index integers instead of
+// strings. Id 0 is the empty string and doubles as "no symbol". Lookup is
+// open addressing over a power-of-two table kept at most half full.
+class Interner {
+private:
+    std::vector<std::string_view> names;
+    std::vector<uint32_t> hashes; // per symbol, to skip most string compares
+    std::vector<SymbolId> slots;  // 0 = empty, otherwise id + 1
+    Arena storage;                // copies of names that would not outlive the caller
+
+    static uint32_t hash(std::string_view text) {
+        uint64_t h = 0xcbf29ce484222325ull; // FNV-1a
+        for (char c : text) {
+            h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
         }
-        // Add function to symbols if needed
-        for (auto child : node->children) {
-            checkStatement(child);
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+
+    void rehash(size_t capacity) {
+        slots.assign(capacity, 0);
+        for (SymbolId id = 0; id < names.size(); id++) {
+            size_t i = hashes[id] & (capacity - 1);
+            while (slots[i] != 0) {
+                i = (i + 1) & (capacity - 1);
+            }
+            slots[i] = id + 1;
         }
     }
 
 public:
-    void check(ASTNode* program) {
-        if (program->type != ASTType::Program) {
-            throw std::runtime_error("Expected program");
-        }
-        for (auto func : program->children) {
-            checkFunction(func);
-        }
+    Interner() {
+        rehash(1024);
+        intern("");
     }
-};
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
 
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Usage: plsa <input.vira>" << std::endl;
-        return 1;
+    // Returns the id for text, adding it if new. With copy set, a new name
+    // is copied into the interner; otherwise text must outlive it.
+    SymbolId intern(std::string_view text, bool copy = false) {
+        uint32_t h = hash(text);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            SymbolId slot = slots[i];
+            if (slot == 0) {
+                if (names.size() >= UINT32_MAX - 1) {
+                    throw std::runtime_error("Too many distinct symbols");
+                }
+                SymbolId id = static_cast<SymbolId>(names.size());
+                names.push_back(copy ? storage.copy(text) : text);
+                hashes.push_back(h);
+                slots[i] = id + 1;
+                if (names.size() * 2 > slots.size()) {
+                    rehash(slots.size() * 2);
+                }
+                return id;
+            }
+            if (hashes[slot - 1] == h && names[slot - 1] == text) {
+                return slot - 1;
+            }
+        }
     }
 
-    std::ifstream file(argv[1]);
-    if (!file) {
-        std::cerr << "Could not open file: " << argv[1] << std::endl;
-        return 1;
+    std::string_view name(SymbolId id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+    size_t bytesUsed() const {
+        return names.capacity() * sizeof(std::string_view) + hashes.capacity() * sizeof(uint32_t) +
+               slots.capacity() * sizeof(SymbolId) + storage.bytesReserved();
     }
+};
 
-    std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+// Work-stealing pool: every worker owns a deque, pops its own work from the
+// front and steals from the back of the others' when it runs dry. A thread
+// waiting in parallelFor() keeps executing queued tasks, so parallel loops may
+// nest (files, then functions within a file) without deadlocking. Threads are
+// only started the first time there is more than one task to run.
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
 
-    try {
-        Parser parser(input);
-        ASTNode* ast = parser.parse();
+    size_t threadCount;
+    std::vector<std::unique_ptr<Queue>> queues; // [0] is shared by non-pool threads
+    std::vector<std::thread> workers;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> nextQueue{0};
+    bool stopping = false;
 
-        // Syntax check is implicit in parsing
+    static size_t& workerIndex() {
+        static thread_local size_t index = 0;
+        return index;
+    }
 
-        SemanticChecker checker;
-        checker.check(ast);
+    void start() {
+        for (size_t i = 0; i < threadCount; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 1; i < threadCount; i++) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
 
-        std::cout << "Parsing and checking successful." << std::endl;
+    void push(size_t queue, std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+        queues[queue]->tasks.push_back(std::move(task));
+        queued.fetch_add(1, std::memory_order_release);
+    }
 
-        delete ast;
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return 1;
+    bool runOne(size_t self) {
+        std::function<void()> task;
+        for (size_t k = 0; k < queues.size() && !task; k++) {
+            Queue& q = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            } else {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (!task) {
+            return false;
+        }
+        task();
+        return true;
     }
 
-    return 0;
+    void workerLoop(size_t self) {
+        workerIndex() = self;
+        for (;;) {
+            if (runOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads) : threadCount(std::max<size_t>(1, threads)) {}
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    size_t size() const { return threadCount; }
+
+    // Runs body(0) .. body(count - 1) across the pool and returns once all
+    // have finished. The first exception thrown by any body (in completion
+    // order) is rethrown here after the rest have run.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body) {
+        if (threadCount == 1 || count <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                body(i);
+            }
+            return;
+        }
+        if (queues.empty()) {
+            start();
+        }
+
+        std::atomic<size_t> remaining(count);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        for (size_t i = 0; i < count; i++) {
+            size_t queue = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+            push(queue, [&, i] {
+                try {
+                    body(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(wakeMutex);
+                    wake.notify_all();
+                }
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+        }
+        wake.notify_all();
+
+        size_t self = workerIndex();
+        while (remaining.load(std::memory_order_acquire) != 0) {
+            if (runOne(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [&] {
+                return remaining.load(std::memory_order_acquire) == 0 || queued.load(std::memory_order_acquire) > 0;
+            });
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+class Lexer {
+private:
+    std::string_view input; // not owned; see SourceBuffer and StreamSource
+    size_t position;
+    size_t limit = SIZE_MAX; // no token starts at or after this position
+    size_t tokenStart = 0;
+    size_t windowBase = 0; // offset of input[0] within the whole source
+    LineTable lineTable;
+    Interner& names;
+    Diagnostics& diagnostics;
+    StreamSource* stream = nullptr;
+    bool copyNames = false; // names must outlive the input
+    bool ranOut = false;
+
+public:
+    Lexer(std::string_view src, Interner& names, Diagnostics& diagnostics, bool copyNames = false)
+        : input(src), position(0), names(names), diagnostics(diagnostics), copyNames(copyNames) {
+        checkSize(src.size());
+        lineTable.indexLazily(src);
+    }
+    Lexer(StreamSource& src, Interner& names, Diagnostics& diagnostics)
+        : position(0), names(names), diagnostics(diagnostics), stream(&src), copyNames(true) {}
+    // Lexes src from begin, which must not be inside a token, up to the
+    // first token that would start at or after end; that token comes out as
+    // an end of input token at its offset instead. For lexing one piece of a
+    // larger input, so offsets are still those in src. lines() is not kept.
+    Lexer(std::string_view src, size_t begin, size_t end, Interner& names, Diagnostics& diagnostics)
+        : input(src), position(begin), limit(end), names(names), diagnostics(diagnostics) {
+        checkSize(src.size());
+    }
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+
+    const LineTable& lines() const { return lineTable; }
+
+    // True once a token ran into the end of input, so lexing the same text
+    // followed by more input could have split it differently.
+    bool reachedEnd() const { return ranOut; }
+
+    // Appends up to limit tokens to out, stopping after the end of input
+    // token. Kept to a plain loop so a later split of the input into chunks
+    // can run it per chunk.
+    void tokenize(std::vector<Token>& out, size_t limit = SIZE_MAX) {
+        for (size_t i = 0; i < limit; i++) {
+            out.push_back(nextToken());
+            if (out.back().type == TokenType::EOFToken) {
+                break;
+            }
+        }
+    }
+
+    // Bytes that cannot start a token are reported and skipped, so one bad
+    // character does not hide the rest of the file's errors.
+    Token nextToken() {
+        for (;;) {
+            skipWhitespace();
+            tokenStart = position;
+            if (position >= limit || !more()) {
+                return {offsetOf(position), 0, 0, TokenType::EOFToken, 0};
+            }
+            char ch = currentChar();
+            if (CharClass::is(ch, CharClass::IdentStart | CharClass::Digit | CharClass::Punct) || ch == '"') {
+                return lexToken(ch);
+            }
+            skipUnexpected();
+        }
+    }
+
+private:
+    // Bytes in a UTF-8 sequence that starts with lead; 1 for ASCII and for
+    // bytes that cannot start one.
+    static size_t utf8Length(unsigned char lead) {
+        return lead >= 0xF5 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC2 ? 2 : 1;
+    }
+
+    // Whether c can be byte i (counting from 0) of a sequence starting with
+    // lead. The second byte's range also rules out overlong forms,
+    // surrogates and code points past U+10FFFF.
+    static bool utf8Follows(unsigned char lead, size_t i, unsigned char c) {
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (i == 1) {
+            lo = lead == 0xE0 ? 0xA0 : lead == 0xF0 ? 0x90 : 0x80;
+            hi = lead == 0xED ? 0x9F : lead == 0xF4 ? 0x8F : 0xBF;
+        }
+        return c >= lo && c <= hi;
+    }
+
+    // Reports and skips one unexpected character: a whole UTF-8 sequence
+    // when the bytes form one, so the message stays valid UTF-8, otherwise
+    // a single byte named by its value.
+    void skipUnexpected() {
+        unsigned char lead = static_cast<unsigned char>(currentChar());
+        size_t length = utf8Length(lead);
+        advance();
+        size_t got = 1;
+        while (got < length && more() && utf8Follows(lead, got, static_cast<unsigned char>(currentChar()))) {
+            advance();
+            got++;
+        }
+        std::string message;
+        if (got == length && (length > 1 || (lead >= 0x21 && lead < 0x7F))) {
+            message = "Unexpected character: " + std::string(view(tokenStart, got));
+        } else {
+            char hex[8];
+            std::snprintf(hex, sizeof hex, "0x%02X", lead);
+            message = std::string("Unexpected byte ") + hex;
+            position = tokenStart + 1; // resume right after the bad byte
+        }
+        diagnostics.report(offsetOf(tokenStart), std::move(message));
+    }
+
+    Token lexToken(char ch) {
+        if (CharClass::is(ch, CharClass::IdentStart)) {
+            return lexIdentifierOrKeyword();
+        } else if (CharClass::is(ch, CharClass::Digit)) {
+            return lexNumber();
+        } else if (ch == '"') {
+            return lexString();
+        }
+        advance();
+        OpKind op = CharClass::op(ch);
+        if (more()) {
+            OpKind pair = Ops::extend(op, currentChar());
+            if (pair != OpKind::None) {
+                advance();
+                op = pair;
+            }
+        }
+        return token(TokenType::Punctuator, 0, static_cast<uint8_t>(op));
+    }
+
+    char currentChar() const {
+        return input[position];
+    }
+
+    std::string_view view(size_t start, size_t length) const {
+        return std::string_view(input.data() + start, length);
+    }
+
+    // True while there is input at position, pulling the next block from the
+    // stream (if any) when the current window is used up.
+    bool more() {
+        return position < input.size() || refill();
+    }
+
+    bool refill() {
+        if (stream == nullptr) {
+            return false;
+        }
+        size_t kept = input.size() - tokenStart;
+        bool grew = stream->refill(tokenStart);
+        windowBase += tokenStart;
+        input = stream->window();
+        position -= tokenStart;
+        tokenStart = 0;
+        checkSize(windowBase + input.size());
+        lineTable.append(windowBase + kept, input.data() + kept, input.size() - kept);
+        return grew;
+    }
+
+    static void checkSize(size_t size) {
+        if (size > UINT32_MAX) {
+            throw std::runtime_error("Input larger than 4 GiB");
+        }
+    }
+
+    uint32_t offsetOf(size_t windowPosition) const {
+        return static_cast<uint32_t>(windowBase + windowPosition);
+    }
+
+    // A token spanning tokenStart up to position.
+    Token token(TokenType type, SymbolId symbol, uint8_t sub = 0) const {
+        return {offsetOf(tokenStart), static_cast<uint32_t>(position - tokenStart), symbol, type, sub};
+    }
+
+    // The interner only copies out of a stream window (or text the caller
+    // will change) the first time a spelling is seen.
+    Token internedToken(TokenType type, std::string_view text) {
+        return token(type, names.intern(text, copyNames));
+    }
+
+    void advance() {
+        position++;
+    }
+
+    // Runs are scanned within the current window; when one reaches the end
+    // of the window, more() pulls the next block and the scan continues.
+    void skipWhitespace() {
+        while (more()) {
+            position += Scan::whitespace(input.data() + position, input.size() - position);
+            tokenStart = position; // nothing before this needs keeping
+            if (position < input.size()) {
+                break;
+            }
+        }
+    }
+
+    // Positions are relative to the window, which refill() may shift, so
+    // token starts are read back from tokenStart rather than saved locally.
+    Token lexIdentifierOrKeyword() {
+        while (more()) {
+            position += Scan::identifier(input.data() + position, input.size() - position);
+            if (position < input.size()) {
+                break;
+            }
+        }
+        std::string_view id = view(tokenStart, position - tokenStart);
+        Keyword keyword = Keywords::lookup(id);
+        if (keyword != Keyword::None) {
+            return token(TokenType::Keyword, 0, static_cast<uint8_t>(keyword));
+        }
+        return internedToken(TokenType::Identifier, id);
+    }
+
+    Token lexNumber() {
+        while (more()) {
+            position += Scan::digits(input.data() + position, input.size() - position);
+            if (position < input.size()) {
+                break;
+            }
+        }
+        return internedToken(TokenType::Number, view(tokenStart, position - tokenStart));
+    }
+
+    Token lexString() {
+        advance(); // skip opening "
+        bool hasEscapes = false;
+        while (more()) {
+            position += Scan::stringBody(input.data() + position, input.size() - position);
+            if (position == input.size()) {
+                continue;
+            }
+            if (currentChar() == '"') {
+                break;
+            }
+            hasEscapes = true; // at a backslash; step over it and the escaped byte
+            advance();
+            if (!more()) {
+                break;
+            }
+            advance();
+        }
+        size_t start = tokenStart + 1;
+        std::string_view body = view(start, position - start);
+        if (position >= input.size()) {
+            // Take the rest of the input as the literal and carry on.
+            diagnostics.report(offsetOf(tokenStart), "Unterminated string literal");
+            ranOut = true;
+        } else {
+            advance(); // skip closing "
+        }
+        if (!hasEscapes) {
+            return internedToken(TokenType::StringLiteral, body);
+        }
+        return token(TokenType::StringLiteral, names.intern(decodeEscapes(body), true));
+    }
+
+    // Only reached for literals that actually contain a backslash.
+    std::string decodeEscapes(std::string_view raw) {
+        std::string out;
+        out.reserve(raw.size());
+        for (size_t i = 0; i < raw.size(); i++) {
+            if (raw[i] != '\\' || i + 1 == raw.size()) {
+                out += raw[i];
+                continue;
+            }
+            char esc = raw[++i];
+            switch (esc) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case '0': out += '\0'; break;
+                case '\\': out += '\\'; break;
+                case '"': out += '"'; break;
+                default: {
+                    // A whole UTF-8 character after the backslash, so the
+                    // message stays valid UTF-8; a byte that starts none is
+                    // named by its value.
+                    unsigned char lead = static_cast<unsigned char>(esc);
+                    size_t length = utf8Length(lead);
+                    size_t got = 1;
+                    while (got < length && i + got < raw.size() &&
+                           utf8Follows(lead, got, static_cast<unsigned char>(raw[i + got]))) {
+                        got++;
+                    }
+                    std::string message = "Unknown escape sequence: \\";
+                    if (got == length && (length > 1 || lead < 0x80)) {
+                        message += raw.substr(i, got);
+                    } else {
+                        char hex[8];
+                        std::snprintf(hex, sizeof hex, "0x%02X", lead);
+                        message = message + " and byte " + hex;
+                        got = 1;
+                    }
+                    diagnostics.report(offsetOf(tokenStart), std::move(message));
+                    out += raw.substr(i, got);
+                    i += got - 1;
+                }
+            }
+        }
+        return out;
+    }
+};
+
+// Lexes a large in-memory input on several threads for the parser, which
+// gets the same tokens, symbols and diagnostics in the same order as from a
+// Lexer. The input is cut after newlines into chunks, lexed a round of one
+// chunk per thread at a time, so memory stays bounded however large the
+// input. Each chunk is lexed as if a token started where it does, with an
+// interner and diagnostics of its own. Only a string literal can run across
+// a newline; when one runs into the next chunk, that chunk is lexed again
+// from where the literal ends until it meets a token the chunk found too,
+// after which the two agree. Symbols then go into the shared interner in
+// order of first use, as a sequential lexer enters them.
+class ChunkedLexer {
+public:
+    static constexpr size_t ChunkBytes = 1 << 20;
+
+    static bool worthwhile(size_t size, const ThreadPool& pool) {
+        return pool.size() > 1 && size >= 2 * ChunkBytes;
+    }
+
+private:
+    struct Chunk {
+        size_t begin = 0;
+        size_t end = 0;
+        std::unique_ptr<Interner> names;
+        std::vector<Token> tokens;  // without the stand-in end of input token, except in the last chunk
+        std::vector<Diagnostic> reports;
+        size_t dropped = 0;         // reports past the error limit
+        bool ranOut = false;
+        std::vector<SymbolId> used; // local symbols of tokens, in order of first use
+        std::vector<SymbolId> ids;  // local symbol to shared symbol
+    };
+
+    std::string_view src;
+    Interner& names;
+    Diagnostics& diagnostics;
+    ThreadPool& pool;
+    bool copyNames;
+    std::vector<Chunk> round;
+    size_t current = 0;    // chunk in round whose tokens are handed out next
+    size_t next = 0;       // token in it
+    size_t lexedTo = 0;    // end of the last token of the rounds so far
+    size_t nextBegin = 0;  // where the next round's first chunk starts
+    std::vector<Diagnostic> pending; // the round's reports not handed on yet
+    size_t nextReport = 0;
+    std::unique_ptr<Lexer> rest; // lexes what is left after a fallback
+    bool ranOut = false;
+
+    size_t cut(size_t begin) const {
+        if (src.size() - begin <= ChunkBytes) {
+            return src.size();
+        }
+        const void* newline = std::memchr(src.data() + begin + ChunkBytes, '\n', src.size() - begin - ChunkBytes);
+        return newline ? static_cast<const char*>(newline) - src.data() + 1 : src.size();
+    }
+
+    size_t limitOf(const Chunk& chunk) const {
+        return chunk.end == src.size() ? SIZE_MAX : chunk.end;
+    }
+
+    static size_t endOf(const Token& token) {
+        return static_cast<size_t>(token.offset) + token.length;
+    }
+
+    // The token before chunk.begin ran into the chunk: lexes again from its
+    // end until reaching a token start the chunk has too, or the chunk's end.
+    // The chunk keeps its tokens from there on and its reports at or after
+    // that offset; the ones lexed again before it come first.
+    void rejoin(Chunk& chunk) {
+        Diagnostics found(diagnostics.maximum());
+        Lexer lexer(src, lexedTo, limitOf(chunk), *chunk.names, found);
+        std::vector<Token> redone;
+        size_t keep = chunk.tokens.size();
+        uint32_t from = UINT32_MAX;
+        for (;;) {
+            Token token = lexer.nextToken();
+            auto same = std::lower_bound(chunk.tokens.begin(), chunk.tokens.end(), token.offset,
+                                         [](const Token& t, uint32_t offset) { return t.offset < offset; });
+            if (same != chunk.tokens.end() && same->offset == token.offset) {
+                keep = static_cast<size_t>(same - chunk.tokens.begin());
+                from = token.offset;
+                break;
+            }
+            if (token.type == TokenType::EOFToken) {
+                break;
+            }
+            redone.push_back(token);
+        }
+        std::vector<Diagnostic> reports;
+        for (const Diagnostic& d : found.all()) {
+            if (d.offset < from) {
+                reports.push_back(d);
+            }
+        }
+        for (Diagnostic& d : chunk.reports) {
+            if (d.offset >= from) {
+                reports.push_back(std::move(d));
+            }
+        }
+        chunk.ranOut = keep < chunk.tokens.size() ? chunk.ranOut : lexer.reachedEnd();
+        chunk.dropped += found.droppedCount();
+        redone.insert(redone.end(), chunk.tokens.begin() + static_cast<ptrdiff_t>(keep), chunk.tokens.end());
+        chunk.tokens = std::move(redone);
+        chunk.reports = std::move(reports);
+    }
+
+    void lexRound() {
+        round.clear();
+        while (round.size() < pool.size() && (round.empty() || nextBegin < src.size())) {
+            Chunk& chunk = round.emplace_back();
+            chunk.begin = nextBegin;
+            chunk.end = cut(nextBegin);
+            nextBegin = chunk.end;
+        }
+        pool.parallelFor(round.size(), [&](size_t i) {
+            Chunk& chunk = round[i];
+            chunk.names = std::make_unique<Interner>();
+            Diagnostics found(diagnostics.maximum());
+            Lexer lexer(src, chunk.begin, limitOf(chunk), *chunk.names, found);
+            chunk.tokens.reserve((chunk.end - chunk.begin) / 4);
+            do {
+                chunk.tokens.push_back(lexer.nextToken());
+            } while (chunk.tokens.back().type != TokenType::EOFToken && !found.full());
+            if (chunk.tokens.back().type == TokenType::EOFToken && limitOf(chunk) != SIZE_MAX) {
+                chunk.tokens.pop_back();
+            }
+            chunk.reports = found.all();
+            // A full chunk is not lexed to its end; the round falls back.
+            chunk.dropped = found.droppedCount() + found.full();
+            chunk.ranOut = lexer.reachedEnd();
+        });
+
+        size_t roundBegin = std::max(lexedTo, round[0].begin);
+        bool overflow = std::any_of(round.begin(), round.end(), [](const Chunk& c) { return c.dropped != 0; });
+        for (Chunk& chunk : round) {
+            if (overflow) {
+                break;
+            }
+            if (lexedTo > chunk.begin) {
+                rejoin(chunk);
+            }
+            overflow |= chunk.dropped != 0;
+            if (!chunk.tokens.empty()) {
+                lexedTo = endOf(chunk.tokens.back());
+            }
+        }
+        if (overflow) {
+            // The kept reports could be short of what the limit lets through;
+            // lex sequentially on from the round's start instead.
+            flushReports(UINT32_MAX);
+            round.clear();
+            rest = std::make_unique<Lexer>(src, roundBegin, SIZE_MAX, names, diagnostics);
+            return;
+        }
+
+        for (const Chunk& chunk : round) {
+            ranOut |= chunk.ranOut && !chunk.tokens.empty();
+        }
+        pool.parallelFor(round.size(), [&](size_t i) {
+            Chunk& chunk = round[i];
+            std::vector<bool> seen(chunk.names->size());
+            for (const Token& token : chunk.tokens) {
+                if (token.symbol != 0 && !seen[token.symbol]) {
+                    seen[token.symbol] = true;
+                    chunk.used.push_back(token.symbol);
+                }
+            }
+        });
+        auto inSource = [&](std::string_view text) {
+            auto at = reinterpret_cast<uintptr_t>(text.data());
+            auto base = reinterpret_cast<uintptr_t>(src.data());
+            return at >= base && at + text.size() <= base + src.size();
+        };
+        for (Chunk& chunk : round) {
+            chunk.ids.assign(chunk.names->size(), 0);
+            for (SymbolId local : chunk.used) {
+                std::string_view text = chunk.names->name(local);
+                chunk.ids[local] = names.intern(text, copyNames || !inSource(text));
+            }
+        }
+        pool.parallelFor(round.size(), [&](size_t i) {
+            Chunk& chunk = round[i];
+            for (Token& token : chunk.tokens) {
+                token.symbol = chunk.ids[token.symbol];
+            }
+            chunk.names.reset();
+        });
+
+        pending.erase(pending.begin(), pending.begin() + static_cast<ptrdiff_t>(nextReport));
+        nextReport = 0;
+        for (Chunk& chunk : round) {
+            for (Diagnostic& d : chunk.reports) {
+                pending.push_back(std::move(d));
+            }
+        }
+        current = 0;
+        next = 0;
+    }
+
+    // A Lexer reports each problem while lexing the next token after it.
+    void flushReports(uint32_t upTo) {
+        while (nextReport < pending.size() && pending[nextReport].offset <= upTo) {
+            diagnostics.report(pending[nextReport].offset, std::move(pending[nextReport].message));
+            nextReport++;
+        }
+    }
+
+public:
+    // src and names as for a Lexer; pool runs the chunks.
+    ChunkedLexer(std::string_view src, Interner& names, Diagnostics& diagnostics, ThreadPool& pool, bool copyNames)
+        : src(src), names(names), diagnostics(diagnostics), pool(pool), copyNames(copyNames) {}
+
+    bool reachedEnd() const { return ranOut || (rest && rest->reachedEnd()); }
+
+    // As Lexer::tokenize.
+    void tokenize(std::vector<Token>& out, size_t limit = SIZE_MAX) {
+        for (size_t i = 0; i < limit; i++) {
+            while (!rest && (current == round.size() || next == round[current].tokens.size())) {
+                if (current < round.size()) {
+                    current++;
+                    next = 0;
+                } else {
+                    lexRound();
+                }
+            }
+            Token token = rest ? rest->nextToken() : round[current].tokens[next++];
+            flushReports(token.offset);
+            out.push_back(token);
+            if (token.type == TokenType::EOFToken) {
+                break;
+            }
+        }
+    }
+};
+
+enum class ASTType : uint8_t {
+    Program,
+    Function,
+    ReturnStmt,
+    BinaryOp,
+    NumberLiteral,
+    Identifier,
+    VarDecl,   // symbol = name; optional initializer child
+    Assign,    // symbol = target; value child
+    Block,
+    IfStmt,    // condition, then, optional else
+    WhileStmt, // condition, body
+    ForStmt,   // init, condition, step, body; missing parts are Empty
+    Empty
+};
+
+// Nodes live in an Arena and are never deleted individually. Their text is
+// an Interner symbol, so the tree is valid as long as both the arena and the
+// interner are.
+//
+// Up to InlineChildren children are stored in the node itself, which covers
+// every node but blocks, function bodies and the program; those spill into
+// an arena array that doubles as it fills. The capacity follows from the
+// count, so a node is no bigger than it was with a vector of children.
+struct ASTNode {
+    static constexpr uint32_t InlineChildren = 4; // a for statement's parts
+
+    struct Children {
+        ASTNode* const* first;
+        ASTNode* const* last;
+
+        ASTNode* const* begin() const { return first; }
+        ASTNode* const* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        ASTNode* operator[](size_t i) const { return first[i]; }
+    };
+
+    ASTType type;
+    SymbolId symbol; // interned spelling for identifiers, operators, etc.
+    uint32_t offset; // source offset of the token the node came from
+
+private:
+    uint32_t childCount = 0;
+    union {
+        ASTNode* inlined[InlineChildren];
+        ASTNode** spilled; // capacity: the power of two above childCount
+    };
+
+    ASTNode* const* firstChild() const { return childCount <= InlineChildren ? inlined : spilled; }
+
+public:
+    ASTNode(ASTType type, SymbolId symbol, uint32_t offset) : type(type), symbol(symbol), offset(offset) {}
+
+    Children children() const { return {firstChild(), firstChild() + childCount}; }
+
+    void addChild(ASTNode* child, Arena& arena) {
+        if (childCount < InlineChildren) {
+            inlined[childCount++] = child;
+            return;
+        }
+        // Full at InlineChildren and at every power of two past it.
+        if ((childCount & (childCount - 1)) == 0) {
+            if (childCount == UINT32_MAX / 2 + 1) {
+                throw std::runtime_error("Too many children in one AST node");
+            }
+            size_t bytes = 2 * size_t{childCount} * sizeof(ASTNode*);
+            ASTNode** grown = static_cast<ASTNode**>(arena.allocate(bytes, alignof(ASTNode*)));
+            std::copy(firstChild(), firstChild() + childCount, grown);
+            spilled = grown;
+        }
+        spilled[childCount++] = child;
+    }
+};
+
+// Binding power of each binary operator, 0 for tokens that do not continue
+// an expression. Higher binds tighter, with the levels ordered as in C; all
+// binary operators are left-associative.
+namespace Precedence {
+constexpr std::array<uint8_t, static_cast<size_t>(OpKind::Count)> makeTable() {
+    std::array<uint8_t, static_cast<size_t>(OpKind::Count)> power{};
+    power[static_cast<size_t>(OpKind::OrOr)] = 2;
+    power[static_cast<size_t>(OpKind::AndAnd)] = 3;
+    power[static_cast<size_t>(OpKind::EqualEqual)] = 5;
+    power[static_cast<size_t>(OpKind::NotEqual)] = 5;
+    power[static_cast<size_t>(OpKind::Less)] = 6;
+    power[static_cast<size_t>(OpKind::Greater)] = 6;
+    power[static_cast<size_t>(OpKind::LessEqual)] = 6;
+    power[static_cast<size_t>(OpKind::GreaterEqual)] = 6;
+    power[static_cast<size_t>(OpKind::Plus)] = 10;
+    power[static_cast<size_t>(OpKind::Minus)] = 10;
+    power[static_cast<size_t>(OpKind::Star)] = 20;
+    power[static_cast<size_t>(OpKind::Slash)] = 20;
+    return power;
+}
+
+constexpr std::array<uint8_t, static_cast<size_t>(OpKind::Count)> table = makeTable();
+
+inline uint8_t of(OpKind op) {
+    return table[static_cast<size_t>(op)];
+}
+}
+
+// Timing and counters for --stats. A phase may run in several stretches
+// (the lexer runs a batch at a time from inside the parser), so its times
+// accumulate.
+struct Stats {
+    struct Phase {
+        double wall = 0; // seconds
+        double cpu = 0;  // seconds of process CPU time, all threads
+    };
+    Phase read, preprocess, lex, parse, check, total;
+    bool cached = false; // the result came from --cache-dir; nothing was parsed
+    uint64_t tokens = 0;
+    uint64_t nodes = 0;
+    uint64_t symbols = 0;
+    uint64_t symbolBytes = 0;
+    uint64_t arenaBytes = 0; // reserved by the tree's arena at its peak
+};
+
+inline double processCpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    auto seconds = [](const FILETIME& t) {
+        return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Adds the time from construction to stop() (or destruction) to a phase;
+// does nothing for a null phase, so callers need not branch on --stats.
+class PhaseTimer {
+private:
+    Stats::Phase* phase;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart = 0;
+
+public:
+    explicit PhaseTimer(Stats::Phase* phase) : phase(phase) {
+        if (phase) {
+            wallStart = std::chrono::steady_clock::now();
+            cpuStart = processCpuSeconds();
+        }
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+    ~PhaseTimer() { stop(); }
+
+    void stop() {
+        if (phase) {
+            phase->wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+            phase->cpu += processCpuSeconds() - cpuStart;
+            phase = nullptr;
+        }
+    }
+};
+
+// Source range of a parsed function, from its 'int' to where the parser is
+// back at top level: just past its '}', or past whatever recovery skipped.
+struct FunctionSpan {
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Recursive-descent parser with panic-mode error recovery. The first error
+// in a statement is reported and puts the parser in panic mode, which
+// silences follow-on errors; the statement loop then skips ahead to the next
+// ';' or '}' and resumes. Parse functions return nullptr when they could not
+// build their construct, and no exceptions are involved.
+class Parser {
+private:
+    Interner& names;
+    Diagnostics& diagnostics;
+    Lexer lexer;
+    Arena& arena;
+    std::string_view source; // empty for a stream
+    bool copyNames;
+    std::unique_ptr<ChunkedLexer> chunked; // lexes instead of lexer when set
+    // Tokens are lexed a batch at a time into a contiguous array that the
+    // parser walks, with lookahead into the rest of the batch and beyond.
+    // A batch fits in L2, so its tokens are still cached when parsed; the
+    // whole file as tokens would be several times the size of the source.
+    // The array ends in the end of input token once the lexer is done.
+    // currentToken is tokens[cursor].
+    std::vector<Token> tokens;
+    size_t cursor = 0;
+    Token currentToken{};
+    uint32_t consumedEnd = 0; // end of the token before currentToken
+    bool panic = false;
+    bool ranOut = false;
+    size_t nodesMade = 0;
+    std::vector<FunctionSpan>* spans = nullptr;
+    Stats* stats = nullptr;
+
+    // Operands and operators waiting for a tighter-binding operator to be
+    // reduced first; see parseExpr. Shared by all expressions, each using
+    // the part above where it started.
+    struct PendingOp {
+        ASTNode* left;
+        Token op;
+        uint8_t power;
+    };
+    std::vector<PendingOp> pendingOps;
+    // Statements that contain statements, while their inner statements are
+    // parsed; see parseStatement. parts holds what is parsed before the
+    // inner statement: the condition, the then branch once the else branch
+    // is open, or a for statement's init, condition and step.
+    enum class Open : uint8_t { Block, Then, Else, LoopBody, ForBody };
+    struct OpenStatement {
+        Open kind;
+        ASTNode* node;
+        ASTNode* parts[3];
+    };
+    std::vector<OpenStatement> openStatements;
+    // Interned spelling of each operator, for BinaryOp nodes.
+    std::array<SymbolId, static_cast<size_t>(OpKind::Count)> opSymbols{};
+
+    ASTNode* makeNode(ASTType type, const Token& token, SymbolId symbol = 0) {
+        nodesMade++;
+        return arena.make<ASTNode>(type, symbol, token.offset);
+    }
+
+    void error(const Token& at, std::string message) {
+        if (at.type == TokenType::EOFToken) {
+            ranOut = true;
+        }
+        if (!panic) {
+            diagnostics.report(at.offset, std::move(message));
+            panic = true;
+        }
+    }
+
+    bool atEnd() const {
+        return currentToken.type == TokenType::EOFToken || diagnostics.full();
+    }
+
+    static constexpr size_t Batch = 4096;
+
+    // Drops the tokens before the current one and lexes the next batch;
+    // false once the end of input token is already buffered.
+    bool fill() {
+        if (!tokens.empty() && tokens.back().type == TokenType::EOFToken) {
+            return false;
+        }
+        tokens.erase(tokens.begin(), tokens.begin() + static_cast<ptrdiff_t>(cursor));
+        cursor = 0;
+        PhaseTimer timer(stats ? &stats->lex : nullptr);
+        size_t kept = tokens.size();
+        if (chunked) {
+            chunked->tokenize(tokens, Batch);
+        } else {
+            lexer.tokenize(tokens, Batch);
+        }
+        if (stats) {
+            stats->tokens += tokens.size() - kept;
+        }
+        return true;
+    }
+
+    // The token n ahead of the current one; the end of input token repeats
+    // past the end.
+    const Token& peek(size_t n) {
+        while (cursor + n >= tokens.size()) {
+            if (!fill()) {
+                return tokens.back();
+            }
+        }
+        return tokens[cursor + n];
+    }
+
+    // fill() keeps the current token, so there is always a next one after
+    // it succeeds.
+    void advance() {
+        consumedEnd = currentToken.offset + currentToken.length;
+        if (cursor + 1 < tokens.size() || fill()) {
+            currentToken = tokens[++cursor];
+        }
+    }
+
+    bool eat(TokenType expected) {
+        if (currentToken.type == expected) {
+            advance();
+            return true;
+        }
+        error(currentToken, "Syntax error");
+        return false;
+    }
+
+    bool eat(OpKind expected) {
+        if (currentToken.op() == expected) {
+            advance();
+            return true;
+        }
+        error(currentToken, "Syntax error: expected '" + std::string(Ops::spelling(expected)) + "'");
+        return false;
+    }
+
+    bool eat(Keyword expected) {
+        if (currentToken.keyword() == expected) {
+            advance();
+            return true;
+        }
+        error(currentToken, "Syntax error: expected '" + std::string(Keywords::spelling(expected)) + "'");
+        return false;
+    }
+
+    // Skips to just past the next ';', or to the next '}' (left for the
+    // enclosing block to close), and leaves panic mode.
+    void synchronize() {
+        while (!atEnd()) {
+            if (isPunct(OpKind::Semicolon)) {
+                advance();
+                break;
+            }
+            if (isPunct(OpKind::RBrace)) {
+                break;
+            }
+            advance();
+        }
+        panic = false;
+    }
+
+    ASTNode* parsePrimary() {
+        if (currentToken.type == TokenType::Number) {
+            ASTNode* node = makeNode(ASTType::NumberLiteral, currentToken, currentToken.symbol);
+            eat(TokenType::Number);
+            return node;
+        } else if (currentToken.type == TokenType::Identifier) {
+            ASTNode* node = makeNode(ASTType::Identifier, currentToken, currentToken.symbol);
+            eat(TokenType::Identifier);
+            return node;
+        } else {
+            error(currentToken, "Unexpected token in primary");
+            return nullptr;
+        }
+    }
+
+    ASTNode* makeBinary(const PendingOp& pending, ASTNode* right) {
+        ASTNode* node = makeNode(ASTType::BinaryOp, pending.op, opSymbols[static_cast<size_t>(pending.op.op())]);
+        node->addChild(pending.left, arena);
+        node->addChild(right, arena);
+        return node;
+    }
+
+    // Precedence climbing with an explicit stack instead of recursion, so
+    // long operator chains cost no stack depth. Before an operator is
+    // pushed, every pending operator that binds at least as tightly is
+    // reduced, which makes equal powers left-associative.
+    ASTNode* parseExpr() {
+        size_t base = pendingOps.size();
+        ASTNode* node = parsePrimary();
+        while (node) {
+            uint8_t power = Precedence::of(currentToken.op());
+            while (pendingOps.size() > base && pendingOps.back().power >= power) {
+                node = makeBinary(pendingOps.back(), node);
+                pendingOps.pop_back();
+            }
+            if (power == 0) {
+                break;
+            }
+            pendingOps.push_back({node, currentToken, power});
+            advance();
+            node = parsePrimary();
+        }
+        pendingOps.resize(base);
+        return node;
+    }
+
+    bool isKeyword(Keyword keyword) const {
+        return currentToken.keyword() == keyword;
+    }
+
+    bool isPunct(OpKind op) const {
+        return currentToken.op() == op;
+    }
+
+    // int name [= expr]  (the trailing ';' is left to the caller). A bad
+    // initializer still yields the declaration, so later uses of the name
+    // do not turn into spurious undefined-identifier errors.
+    ASTNode* parseVarDecl() {
+        eat(Keyword::Int);
+        Token name = currentToken;
+        if (!eat(TokenType::Identifier)) {
+            return nullptr;
+        }
+        ASTNode* node = makeNode(ASTType::VarDecl, name, name.symbol);
+        if (isPunct(OpKind::Assign)) {
+            eat(OpKind::Assign);
+            if (ASTNode* init = parseExpr()) {
+                node->addChild(init, arena);
+            }
+        }
+        return node;
+    }
+
+    // name = expr
+    ASTNode* parseAssign() {
+        Token target = currentToken;
+        if (!eat(TokenType::Identifier) || !eat(OpKind::Assign)) {
+            return nullptr;
+        }
+        ASTNode* value = parseExpr();
+        if (!value) {
+            return nullptr;
+        }
+        ASTNode* node = makeNode(ASTType::Assign, target, target.symbol);
+        node->addChild(value, arena);
+        return node;
+    }
+
+    // Statements up to the closing '}', recovering after each bad one.
+    void parseStatements(ASTNode* parent) {
+        while (!isPunct(OpKind::RBrace) && !atEnd()) {
+            ASTNode* stmt = parseStatement();
+            if (stmt) {
+                parent->addChild(stmt, arena);
+            }
+            if (panic) {
+                synchronize();
+            }
+        }
+    }
+
+    // Returns the for statement with its header parsed, or nullptr. Its
+    // init, condition and step are the first parts of the open statement
+    // pushed for its body (see parseStatement).
+    ASTNode* parseForHeader(OpenStatement& open) {
+        ASTNode* node = makeNode(ASTType::ForStmt, currentToken);
+        eat(Keyword::For);
+        if (!eat(OpKind::LParen)) {
+            return nullptr;
+        }
+        ASTNode* init = isPunct(OpKind::Semicolon) ? makeNode(ASTType::Empty, currentToken)
+                                     : (isKeyword(Keyword::Int) ? parseVarDecl() : parseAssign());
+        if (!init || !eat(OpKind::Semicolon)) {
+            return nullptr;
+        }
+        ASTNode* cond = isPunct(OpKind::Semicolon) ? makeNode(ASTType::Empty, currentToken) : parseExpr();
+        if (!cond || !eat(OpKind::Semicolon)) {
+            return nullptr;
+        }
+        ASTNode* step = isPunct(OpKind::RParen) ? makeNode(ASTType::Empty, currentToken) : parseAssign();
+        if (!step || !eat(OpKind::RParen)) {
+            return nullptr;
+        }
+        open = {Open::ForBody, node, {init, cond, step}};
+        return node;
+    }
+
+    // Parses a statement that holds no other statement, or the head of one
+    // that does: then it pushes an open statement and returns false.
+    // Statement-level constructs that need all their parts yield nullptr as
+    // soon as one is missing; the statement loop takes over from there.
+    bool startStatement(ASTNode*& done) {
+        done = nullptr;
+        if (isKeyword(Keyword::Return)) {
+            Token keyword = currentToken;
+            eat(Keyword::Return);
+            ASTNode* expr = parseExpr();
+            if (!expr || !eat(OpKind::Semicolon)) {
+                return true;
+            }
+            done = makeNode(ASTType::ReturnStmt, keyword);
+            done->addChild(expr, arena);
+        } else if (isKeyword(Keyword::Int) && peek(1).type == TokenType::Identifier &&
+                   peek(2).op() == OpKind::LParen) {
+            // int name( ... inside a body: report it once and skip the whole
+            // definition rather than tripping over every line of it.
+            error(currentToken, "Nested function definitions are not supported");
+            synchronizeFunction();
+        } else if (isKeyword(Keyword::Int)) {
+            done = parseVarDecl();
+            if (done && !panic) {
+                eat(OpKind::Semicolon);
+            }
+        } else if (currentToken.type == TokenType::Identifier) {
+            done = parseAssign();
+            if (done && !eat(OpKind::Semicolon)) {
+                done = nullptr;
+            }
+        } else if (isPunct(OpKind::LBrace)) {
+            openStatements.push_back({Open::Block, makeNode(ASTType::Block, currentToken), {}});
+            eat(OpKind::LBrace);
+            return false;
+        } else if (isKeyword(Keyword::If) || isKeyword(Keyword::While)) {
+            bool isIf = isKeyword(Keyword::If);
+            ASTNode* node = makeNode(isIf ? ASTType::IfStmt : ASTType::WhileStmt, currentToken);
+            advance();
+            if (!eat(OpKind::LParen)) {
+                return true;
+            }
+            ASTNode* cond = parseExpr();
+            if (!cond || !eat(OpKind::RParen)) {
+                return true;
+            }
+            openStatements.push_back({isIf ? Open::Then : Open::LoopBody, node, {cond}});
+            return false;
+        } else if (isKeyword(Keyword::For)) {
+            OpenStatement open{};
+            if (!parseForHeader(open)) {
+                return true;
+            }
+            openStatements.push_back(open);
+            return false;
+        } else {
+            error(currentToken, "Unsupported statement");
+        }
+        return true;
+    }
+
+    // Whether the innermost open block has another statement to parse.
+    bool blockContinues() {
+        return !isPunct(OpKind::RBrace) && !atEnd();
+    }
+
+    ASTNode* closeBlock() {
+        ASTNode* node = openStatements.back().node;
+        openStatements.pop_back();
+        eat(OpKind::RBrace);
+        return node;
+    }
+
+    // One whole statement. Statements nest as deeply as the input does, so
+    // the ones still waiting for an inner statement are kept on
+    // openStatements rather than the stack: each inner statement that ends
+    // is handed to the open statements it completes, innermost first.
+    ASTNode* parseStatement() {
+        size_t base = openStatements.size();
+        for (;;) {
+            ASTNode* done;
+            if (!startStatement(done)) {
+                if (openStatements.back().kind != Open::Block || blockContinues()) {
+                    continue;
+                }
+                done = closeBlock();
+            }
+            for (;;) {
+                if (openStatements.size() == base) {
+                    return done;
+                }
+                OpenStatement& open = openStatements.back();
+                if (open.kind == Open::Block) {
+                    if (done) {
+                        open.node->addChild(done, arena);
+                    }
+                    if (panic) {
+                        synchronize();
+                    }
+                    if (blockContinues()) {
+                        break;
+                    }
+                    done = closeBlock();
+                    continue;
+                }
+                if (done && open.kind == Open::Then && isKeyword(Keyword::Else)) {
+                    eat(Keyword::Else);
+                    open.parts[1] = done;
+                    open.kind = Open::Else;
+                    break;
+                }
+                if (done) {
+                    size_t parts = open.kind == Open::ForBody ? 3 : open.kind == Open::Else ? 2 : 1;
+                    for (size_t i = 0; i < parts; i++) {
+                        open.node->addChild(open.parts[i], arena);
+                    }
+                    open.node->addChild(done, arena);
+                    done = open.node;
+                }
+                openStatements.pop_back();
+            }
+        }
+    }
+
+    ASTNode* parseFunction() {
+        eat(Keyword::Int);
+        Token name = currentToken;
+        if (!eat(TokenType::Identifier) || !eat(OpKind::LParen) ||
+            !eat(OpKind::RParen) || !eat(OpKind::LBrace)) {
+            return nullptr;
+        }
+        ASTNode* node = makeNode(ASTType::Function, name, name.symbol);
+        parseStatements(node);
+        eat(OpKind::RBrace);
+        return node;
+    }
+
+    // After a bad function header, skips past the '}' that closes the
+    // function body, counting nested braces on the way.
+    void synchronizeFunction() {
+        int depth = 0;
+        bool closed = false;
+        while (!closed && !atEnd()) {
+            bool close = isPunct(OpKind::RBrace);
+            depth += isPunct(OpKind::LBrace) ? 1 : 0;
+            advance();
+            closed = close && --depth <= 0;
+        }
+        ranOut = ranOut || !closed;
+        panic = false;
+    }
+
+    void internOperators() {
+        for (size_t i = 1; i < opSymbols.size(); i++) {
+            if (Precedence::table[i] != 0) {
+                opSymbols[i] = names.intern(Ops::spelling(static_cast<OpKind>(i)));
+            }
+        }
+    }
+
+public:
+    // With copyNames the interned spellings do not point into src, so the
+    // tree stays valid after src changes.
+    Parser(std::string_view src, Arena& arena, Interner& names, Diagnostics& diagnostics, bool copyNames = false)
+        : names(names), diagnostics(diagnostics), lexer(src, names, diagnostics, copyNames), arena(arena), source(src),
+          copyNames(copyNames) {
+        internOperators();
+    }
+    Parser(StreamSource& src, Arena& arena, Interner& names, Diagnostics& diagnostics)
+        : names(names), diagnostics(diagnostics), lexer(src, names, diagnostics), arena(arena), copyNames(true) {
+        internOperators();
+    }
+
+    // Has parse() lex on pool's threads, a round of chunks ahead of the
+    // parser, if the input is in memory and large enough to gain from it.
+    void lexInParallel(ThreadPool& pool) {
+        if (ChunkedLexer::worthwhile(source.size(), pool)) {
+            chunked = std::make_unique<ChunkedLexer>(source, names, diagnostics, pool, copyNames);
+        }
+    }
+
+    const LineTable& lines() const { return lexer.lines(); }
+
+    // Makes parse() append the span of each function it keeps to out.
+    void recordFunctions(std::vector<FunctionSpan>& out) { spans = &out; }
+
+    // Makes parse() add its lexing time and token count to out.
+    void collectStats(Stats& out) { stats = &out; }
+
+    // Nodes made so far, including any dropped with a statement that could
+    // not be parsed: at least the size of the tree.
+    size_t nodeCount() const { return nodesMade; }
+
+    // True if the end of input cut a token, a function or an error recovery
+    // short. Otherwise the same tree comes out of this input followed by
+    // any further functions, which is what makes reparsing part of an
+    // edited file safe.
+    bool reachedEnd() const { return ranOut || (chunked ? chunked->reachedEnd() : lexer.reachedEnd()); }
+
+    // Always returns a Program; functions that could not be parsed are
+    // left out and their errors are in the Diagnostics.
+    ASTNode* parse() {
+        fill();
+        currentToken = tokens[0];
+        ASTNode* program = makeNode(ASTType::Program, currentToken);
+        while (!atEnd()) {
+            uint32_t begin = currentToken.offset;
+            ASTNode* func = parseFunction();
+            if (panic) {
+                synchronizeFunction();
+            }
+            if (func) {
+                program->addChild(func, arena);
+                if (spans) {
+                    spans->push_back({begin, consumedEnd});
+                }
+            }
+        }
+        return program;
+    }
+};
+
+using NodeId = uint32_t;
+
+// Compact, pre-order form of the tree that the checker and later passes walk.
+// Node n's descendants occupy [n + 1, subtreeEnd[n]); its first child is n + 1
+// and each child's next sibling starts at that child's subtreeEnd. Payloads
+// are symbols of the Interner the tree was parsed with, 0 meaning none.
+struct FlatAST {
+    std::vector<ASTType> kinds;
+    std::vector<SymbolId> payloads;
+    std::vector<NodeId> subtreeEnd;
+    std::vector<uint32_t> offsets;
+    const Interner* names = nullptr;
+
+    NodeId size() const { return static_cast<NodeId>(kinds.size()); }
+    std::string_view text(NodeId n) const { return names->name(payloads[n]); }
+
+    size_t bytesUsed() const {
+        return kinds.capacity() * sizeof(ASTType) + payloads.capacity() * sizeof(SymbolId) +
+               subtreeEnd.capacity() * sizeof(NodeId) + offsets.capacity() * sizeof(uint32_t);
+    }
+    NodeId firstChild(NodeId n) const { return n + 1; }
+    NodeId nextSibling(NodeId n) const { return subtreeEnd[n]; }
+
+    uint32_t childCount(NodeId n) const {
+        uint32_t count = 0;
+        for (NodeId c = firstChild(n); c < subtreeEnd[n]; c = nextSibling(c)) {
+            count++;
+        }
+        return count;
+    }
+};
+
+// Walks the tree with an explicit stack rather than recursion, since a long
+// operator chain is a left-deep tree as deep as the chain is long. Leaves,
+// about half of all nodes, never get a frame.
+class Flattener {
+private:
+    struct Frame {
+        ASTNode* const* next; // the next child to emit
+        ASTNode* const* end;
+        NodeId id;
+    };
+
+    FlatAST& out;
+    std::vector<Frame> stack;
+
+    void enter(const ASTNode* node) {
+        if (out.kinds.size() >= UINT32_MAX) {
+            throw std::runtime_error("AST too large for 32-bit node ids");
+        }
+        NodeId id = out.size();
+        out.kinds.push_back(node->type);
+        out.payloads.push_back(node->symbol);
+        out.subtreeEnd.push_back(id + 1);
+        out.offsets.push_back(node->offset);
+        ASTNode::Children children = node->children();
+        if (children.size() != 0) {
+            stack.push_back({children.begin(), children.end(), id});
+        }
+    }
+
+public:
+    explicit Flattener(FlatAST& out) : out(out) {}
+
+    void flatten(const ASTNode* root) {
+        enter(root);
+        while (!stack.empty()) {
+            Frame& top = stack.back();
+            if (top.next != top.end) {
+                enter(*top.next++);
+            } else {
+                out.subtreeEnd[top.id] = out.size();
+                stack.pop_back();
+            }
+        }
+    }
+};
+
+// With nodes, the parser's nodeCount(), the arrays are sized up front.
+inline FlatAST flatten(const ASTNode* root, const Interner& names, size_t nodes = 0) {
+    FlatAST ast;
+    ast.names = &names;
+    ast.kinds.reserve(nodes);
+    ast.payloads.reserve(nodes);
+    ast.subtreeEnd.reserve(nodes);
+    ast.offsets.reserve(nodes);
+    Flattener(ast).flatten(root);
+    return ast;
+}
+
+// Types the checker knows about.
+enum class Type : uint8_t {
+    None, // not declared
+    Int,
+};
+
+// Block scoping for one linear walk over a FlatAST range. Each symbol has
+// one current binding in a table indexed by SymbolId. Declaring a name
+// records the binding it shadows in an undo log, and leaving a scope replays
+// the log back to the scope's mark. Entering and leaving a scope therefore
+// costs O(declarations in it), however large the table or deep the nesting.
+class Scopes {
+private:
+    struct Binding {
+        Type type = Type::None;
+        uint32_t depth = 0;
+    };
+
+    struct Undo {
+        SymbolId symbol;
+        Binding previous;
+    };
+
+    struct Scope {
+        NodeId end;       // first node past the scope's subtree
+        size_t undoMark;  // undo log size on entry
+    };
+
+    std::vector<Binding> bindings;
+    std::vector<Undo> undo;
+    std::vector<Scope> open;
+
+public:
+    explicit Scopes(size_t symbols) : bindings(symbols) {}
+
+    void enter(NodeId end) {
+        open.push_back({end, undo.size()});
+    }
+
+    // Closes every scope whose subtree ends at or before node n.
+    void leaveBefore(NodeId n) {
+        while (!open.empty() && open.back().end <= n) {
+            for (size_t i = undo.size(); i > open.back().undoMark; i--) {
+                bindings[undo[i - 1].symbol] = undo[i - 1].previous;
+            }
+            undo.resize(open.back().undoMark);
+            open.pop_back();
+        }
+    }
+
+    // Returns false if name is already declared in the innermost scope.
+    bool declare(SymbolId symbol, Type type) {
+        uint32_t depth = static_cast<uint32_t>(open.size());
+        Binding& binding = bindings[symbol];
+        if (binding.type != Type::None && binding.depth == depth) {
+            return false;
+        }
+        undo.push_back({symbol, binding});
+        binding = {type, depth};
+        return true;
+    }
+
+    Type lookup(SymbolId symbol) const {
+        return bindings[symbol].type;
+    }
+};
+
+// Reports every problem it finds into a Diagnostics instead of stopping at
+// the first, so one run lists all undefined or redeclared names.
+class SemanticChecker {
+private:
+    // Per-range walk state. A declaration takes effect once its initializer
+    // has been checked, i.e. at the end of its subtree; expressions cannot
+    // contain declarations, so at most one is pending at a time.
+    struct Walk {
+        Scopes scopes;
+        Diagnostics& diagnostics;
+        NodeId pendingDecl = 0; // VarDecl node, 0 if none
+
+        Walk(size_t symbols, Diagnostics& diagnostics) : scopes(symbols), diagnostics(diagnostics) {}
+    };
+
+    static bool isExpr(ASTType type) {
+        return type == ASTType::NumberLiteral || type == ASTType::Identifier || type == ASTType::BinaryOp;
+    }
+
+    static bool isStatement(ASTType type) {
+        switch (type) {
+            case ASTType::ReturnStmt:
+            case ASTType::VarDecl:
+            case ASTType::Assign:
+            case ASTType::Block:
+            case ASTType::IfStmt:
+            case ASTType::WhileStmt:
+            case ASTType::ForStmt:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static void requireStatements(const FlatAST& ast, NodeId first, NodeId end, Walk& walk) {
+        for (NodeId c = first; c < end; c = ast.nextSibling(c)) {
+            if (!isStatement(ast.kinds[c])) {
+                walk.diagnostics.report(ast.offsets[c], "Unsupported statement in semantic check");
+            }
+        }
+    }
+
+    static void requireExpr(const FlatAST& ast, NodeId c, Walk& walk) {
+        if (!isExpr(ast.kinds[c])) {
+            walk.diagnostics.report(ast.offsets[c], "Unsupported expr in semantic check");
+        }
+    }
+
+    static void undefined(const FlatAST& ast, NodeId n, Walk& walk) {
+        walk.diagnostics.report(ast.offsets[n], "Undefined identifier: " + std::string(ast.text(n)));
+    }
+
+    // Each node validates the shape of its direct children, so every node is
+    // looked at a constant number of times and the walk stays one linear scan.
+    static void checkNode(const FlatAST& ast, NodeId n, Walk& walk) {
+        NodeId first = ast.firstChild(n);
+        NodeId end = ast.subtreeEnd[n];
+        switch (ast.kinds[n]) {
+            case ASTType::Program:
+                walk.diagnostics.report(ast.offsets[n], "Expected function");
+                break;
+            case ASTType::Function:
+            case ASTType::Block:
+                walk.scopes.enter(end);
+                requireStatements(ast, first, end, walk);
+                break;
+            case ASTType::ReturnStmt:
+                if (end == n + 1) {
+                    walk.diagnostics.report(ast.offsets[n], "Return statement missing expression");
+                } else {
+                    requireExpr(ast, first, walk);
+                }
+                break;
+            case ASTType::VarDecl:
+                if (end != first) {
+                    requireExpr(ast, first, walk);
+                }
+                walk.pendingDecl = n;
+                break;
+            case ASTType::Assign:
+                if (walk.scopes.lookup(ast.payloads[n]) == Type::None) {
+                    undefined(ast, n, walk);
+                }
+                requireExpr(ast, first, walk);
+                break;
+            case ASTType::IfStmt:
+            case ASTType::WhileStmt: {
+                // Each branch gets a scope of its own, as in C++. The else
+                // branch's is entered first and stays empty until the then
+                // branch's closes at its end.
+                walk.scopes.enter(end);
+                uint32_t count = ast.childCount(n);
+                if (count < 2 || count > (ast.kinds[n] == ASTType::IfStmt ? 3u : 2u)) {
+                    walk.diagnostics.report(ast.offsets[n], "Malformed control statement");
+                    break;
+                }
+                requireExpr(ast, first, walk);
+                NodeId body = ast.nextSibling(first);
+                if (count == 3) {
+                    walk.scopes.enter(ast.nextSibling(body));
+                }
+                requireStatements(ast, body, end, walk);
+                break;
+            }
+            case ASTType::ForStmt: {
+                walk.scopes.enter(end); // the init declaration is local to the loop
+                if (ast.childCount(n) != 4) {
+                    walk.diagnostics.report(ast.offsets[n], "Malformed for statement");
+                    break;
+                }
+                NodeId cond = ast.nextSibling(first);
+                NodeId step = ast.nextSibling(cond);
+                NodeId body = ast.nextSibling(step);
+                ASTType init = ast.kinds[first];
+                if (init != ASTType::Empty && init != ASTType::VarDecl && init != ASTType::Assign) {
+                    walk.diagnostics.report(ast.offsets[first], "Unsupported for initializer");
+                }
+                if (ast.kinds[cond] != ASTType::Empty) {
+                    requireExpr(ast, cond, walk);
+                }
+                if (ast.kinds[step] != ASTType::Empty && ast.kinds[step] != ASTType::Assign) {
+                    walk.diagnostics.report(ast.offsets[step], "Unsupported for step");
+                }
+                requireStatements(ast, body, end, walk);
+                break;
+            }
+            case ASTType::Empty:
+                break;
+            case ASTType::BinaryOp:
+                if (ast.childCount(n) != 2) {
+                    walk.diagnostics.report(ast.offsets[n], "Binary op needs two children");
+                    break;
+                }
+                requireExpr(ast, first, walk);
+                requireExpr(ast, ast.nextSibling(first), walk);
+                // Type checking could be added here
+                break;
+            case ASTType::NumberLiteral:
+                break;
+            case ASTType::Identifier:
+                if (walk.scopes.lookup(ast.payloads[n]) == Type::None) {
+                    undefined(ast, n, walk);
+                }
+                break;
+        }
+    }
+
+    static void declarePending(const FlatAST& ast, Walk& walk) {
+        NodeId decl = walk.pendingDecl;
+        walk.pendingDecl = 0;
+        if (!walk.scopes.declare(ast.payloads[decl], Type::Int)) {
+            walk.diagnostics.report(ast.offsets[decl], "Redeclaration of " + std::string(ast.text(decl)));
+        }
+    }
+
+    static void checkRange(const FlatAST& ast, NodeId begin, NodeId end, Diagnostics& diagnostics) {
+        Walk walk(ast.names->size(), diagnostics);
+        for (NodeId n = begin; n < end && !diagnostics.full(); n++) {
+            // Declare before closing scopes: a declaration that ends a block
+            // still belongs to that block.
+            if (walk.pendingDecl != 0 && ast.subtreeEnd[walk.pendingDecl] <= n) {
+                declarePending(ast, walk);
+            }
+            walk.scopes.leaveBefore(n);
+            checkNode(ast, n, walk);
+        }
+        if (walk.pendingDecl != 0) {
+            declarePending(ast, walk);
+        }
+    }
+
+    // Functions are independent, so large programs are checked a chunk of
+    // functions per task. Below this many nodes a single scan is cheaper
+    // than handing out work.
+    static constexpr NodeId ParallelThreshold = 1 << 16;
+
+public:
+    static void check(const FlatAST& ast, Diagnostics& diagnostics, ThreadPool* pool = nullptr) {
+        if (ast.size() == 0 || ast.kinds[0] != ASTType::Program) {
+            diagnostics.report(0, "Expected program");
+            return;
+        }
+        for (NodeId f = ast.firstChild(0); f < ast.subtreeEnd[0]; f = ast.nextSibling(f)) {
+            if (ast.kinds[f] != ASTType::Function) {
+                diagnostics.report(ast.offsets[f], "Expected function");
+                return;
+            }
+        }
+        if (pool == nullptr || pool->size() == 1 || ast.size() < ParallelThreshold) {
+            checkRange(ast, 1, ast.size(), diagnostics);
+            return;
+        }
+
+        // Cut the node range at function boundaries into chunks of roughly
+        // equal size, a few per thread so stealing can even out the load.
+        NodeId target = std::max<NodeId>(ast.size() / static_cast<NodeId>(pool->size() * 4), 4096);
+        std::vector<NodeId> bounds{1};
+        for (NodeId f = ast.firstChild(0); f < ast.subtreeEnd[0]; f = ast.nextSibling(f)) {
+            if (ast.subtreeEnd[f] - bounds.back() >= target) {
+                bounds.push_back(ast.subtreeEnd[f]);
+            }
+        }
+        if (bounds.back() != ast.size()) {
+            bounds.push_back(ast.size());
+        }
+
+        // Each chunk collects into its own list; merging them in chunk order
+        // gives the same reports, in the same order, as a sequential scan.
+        size_t chunks = bounds.size() - 1;
+        std::vector<Diagnostics> found(chunks, Diagnostics(diagnostics.maximum()));
+        pool->parallelFor(chunks, [&](size_t i) {
+            checkRange(ast, bounds[i], bounds[i + 1], found[i]);
+        });
+        for (const Diagnostics& chunk : found) {
+            diagnostics.append(chunk);
+        }
+    }
+};
+
+// Optional pass over a checked tree, for the tree handed to the compiler:
+// constant subexpressions become single NumberLiterals, so the compiler does
+// not build and lower literal arithmetic. Values are 32-bit ints, as the
+// compiler generates them; anything that would overflow or divide by zero is
+// left for run time. Along the way constants move to the right of + * == !=,
+// chains such as x + 1 + 2 become x + 3, and x + 0, x - 0, x * 1 and x / 1
+// become x. Folded literals may be negative. Expressions have no side
+// effects, so 0 && x and 1 || x fold too.
+class ConstantFolder {
+private:
+    enum class Form : uint8_t {
+        Keep,       // copied, with each child emitted by its own form
+        Constant,   // a literal of value
+        Forward,    // replaced by node left
+        OpConstant, // the op over node left and the constant value, which
+                    // is node right unless that is None
+    };
+    static constexpr NodeId None = UINT32_MAX;
+
+    struct Node {
+        Form form = Form::Keep;
+        int32_t value = 0;
+        NodeId left = 0, right = 0;
+    };
+
+    const FlatAST& ast;
+    Interner& names;
+    std::vector<Node> nodes;
+    std::vector<OpKind> ops; // by symbol; the parser interns operators first, so this stays short
+    std::vector<NodeId> rewrites; // rewritten nodes before each node, plus a total
+
+    static bool parseLiteral(std::string_view text, int32_t& out) {
+        int64_t value = 0;
+        for (char c : text) {
+            value = value * 10 + (c - '0');
+            if (value > INT32_MAX) {
+                return false;
+            }
+        }
+        out = static_cast<int32_t>(value);
+        return true;
+    }
+
+    // False if op is not folded or the result is not a 32-bit int.
+    static bool evaluate(OpKind op, int64_t a, int64_t b, int32_t& out) {
+        int64_t value;
+        switch (op) {
+            case OpKind::Plus: value = a + b; break;
+            case OpKind::Minus: value = a - b; break;
+            case OpKind::Star: value = a * b; break;
+            case OpKind::Slash:
+                if (b == 0) {
+                    return false;
+                }
+                value = a / b; // INT32_MIN / -1 is caught by the range check below
+                break;
+            case OpKind::Less: value = a < b; break;
+            case OpKind::Greater: value = a > b; break;
+            case OpKind::LessEqual: value = a <= b; break;
+            case OpKind::GreaterEqual: value = a >= b; break;
+            case OpKind::EqualEqual: value = a == b; break;
+            case OpKind::NotEqual: value = a != b; break;
+            case OpKind::AndAnd: value = a != 0 && b != 0; break;
+            case OpKind::OrOr: value = a != 0 || b != 0; break;
+            default: return false;
+        }
+        if (value < INT32_MIN || value > INT32_MAX) {
+            return false;
+        }
+        out = static_cast<int32_t>(value);
+        return true;
+    }
+
+    OpKind opOf(NodeId n) const {
+        SymbolId symbol = ast.payloads[n];
+        return symbol < ops.size() ? ops[symbol] : OpKind::None;
+    }
+
+    bool constant(NodeId n, int32_t& value) const {
+        value = nodes[n].value;
+        return nodes[n].form == Form::Constant;
+    }
+
+    void setConstant(NodeId n, int32_t value) {
+        nodes[n].form = Form::Constant;
+        nodes[n].value = value;
+    }
+
+    void foldBinary(NodeId n) {
+        NodeId l = ast.firstChild(n);
+        NodeId r = ast.nextSibling(l);
+        OpKind op = opOf(n);
+        int32_t a, b;
+        bool constantLeft = constant(l, a);
+        bool constantRight = constant(r, b);
+        int32_t value;
+        if (constantLeft && constantRight && evaluate(op, a, b, value)) {
+            setConstant(n, value);
+            rewrites[n] = 1;
+            return;
+        }
+        if (constantLeft && ((op == OpKind::AndAnd && a == 0) || (op == OpKind::OrOr && a != 0))) {
+            setConstant(n, op == OpKind::OrOr);
+            rewrites[n] = 1;
+            return;
+        }
+        bool commutative =
+            op == OpKind::Plus || op == OpKind::Star || op == OpKind::EqualEqual || op == OpKind::NotEqual;
+        if (constantLeft && !constantRight && commutative) {
+            std::swap(l, r);
+            b = a;
+            constantRight = true;
+            rewrites[n] = 1;
+        }
+        if (!constantRight) {
+            return;
+        }
+        // l op b, with l not constant. An inner l = x op c of the same
+        // associative op merges into x op (c op b).
+        if ((op == OpKind::Plus || op == OpKind::Star) && nodes[l].form == Form::OpConstant &&
+            opOf(l) == op && evaluate(op, nodes[l].value, b, value)) {
+            l = nodes[l].left;
+            r = None;
+            b = value;
+            rewrites[n] = 1;
+        }
+        if (((op == OpKind::Plus || op == OpKind::Minus) && b == 0) ||
+            ((op == OpKind::Star || op == OpKind::Slash) && b == 1)) {
+            nodes[n].form = Form::Forward;
+            nodes[n].left = l;
+            rewrites[n] = 1;
+            return;
+        }
+        nodes[n].form = Form::OpConstant;
+        nodes[n].left = l;
+        nodes[n].right = r;
+        nodes[n].value = b;
+    }
+
+    struct Task {
+        enum Kind : uint8_t { Emit, Literal, Close } kind;
+        NodeId node;        // Emit: the source node; Close: the output node
+        NodeId siblingsEnd; // Emit: the node's later siblings before this follow it
+        int32_t value;      // Literal
+        uint32_t offset;    // Literal
+    };
+
+    static Task emit(NodeId node, NodeId siblingsEnd = 0) { return {Task::Emit, node, siblingsEnd, 0, 0}; }
+
+    void emitNode(FlatAST& out, std::vector<Task>& tasks, ASTType kind, SymbolId payload, uint32_t offset) {
+        tasks.push_back({Task::Close, out.size(), 0, 0, 0});
+        out.kinds.push_back(kind);
+        out.payloads.push_back(payload);
+        out.subtreeEnd.push_back(0);
+        out.offsets.push_back(offset);
+    }
+
+    // Writes the pre-order of the rewritten tree with an explicit stack,
+    // copying subtrees without rewrites in one go.
+    FlatAST rebuild() {
+        FlatAST out;
+        out.names = &names;
+        out.kinds.reserve(ast.size());
+        out.payloads.reserve(ast.size());
+        out.subtreeEnd.reserve(ast.size());
+        out.offsets.reserve(ast.size());
+        std::vector<Task> tasks{emit(0)};
+        while (!tasks.empty()) {
+            Task task = tasks.back();
+            tasks.pop_back();
+            if (task.kind == Task::Close) {
+                out.subtreeEnd[task.node] = out.size();
+                continue;
+            }
+            if (task.kind == Task::Literal) {
+                emitNode(out, tasks, ASTType::NumberLiteral, names.intern(std::to_string(task.value), true),
+                         task.offset);
+                continue;
+            }
+            NodeId n = task.node;
+            NodeId end = ast.subtreeEnd[n];
+            if (end < task.siblingsEnd) {
+                tasks.push_back(emit(end, task.siblingsEnd));
+            }
+            if (rewrites[end] == rewrites[n]) {
+                NodeId shift = n - out.size();
+                out.kinds.insert(out.kinds.end(), ast.kinds.begin() + n, ast.kinds.begin() + end);
+                out.payloads.insert(out.payloads.end(), ast.payloads.begin() + n, ast.payloads.begin() + end);
+                out.offsets.insert(out.offsets.end(), ast.offsets.begin() + n, ast.offsets.begin() + end);
+                for (NodeId i = n; i < end; i++) {
+                    out.subtreeEnd.push_back(ast.subtreeEnd[i] - shift);
+                }
+                continue;
+            }
+            const Node& node = nodes[n];
+            switch (node.form) {
+                case Form::Keep:
+                    emitNode(out, tasks, ast.kinds[n], ast.payloads[n], ast.offsets[n]);
+                    if (n + 1 < end) {
+                        tasks.push_back(emit(n + 1, end));
+                    }
+                    break;
+                case Form::Constant: // a folded op; literals are never rewritten
+                    tasks.push_back({Task::Literal, 0, 0, node.value, ast.offsets[n]});
+                    break;
+                case Form::Forward:
+                    tasks.push_back(emit(node.left));
+                    break;
+                case Form::OpConstant:
+                    emitNode(out, tasks, ASTType::BinaryOp, ast.payloads[n], ast.offsets[n]);
+                    if (node.right == None) {
+                        tasks.push_back({Task::Literal, 0, 0, node.value, ast.offsets[n]});
+                    } else {
+                        tasks.push_back(emit(node.right));
+                    }
+                    tasks.push_back(emit(node.left));
+                    break;
+            }
+        }
+        return out;
+    }
+
+    ConstantFolder(const FlatAST& ast, Interner& names)
+        : ast(ast), names(names), nodes(ast.size()), rewrites(ast.size() + 1) {
+        for (size_t i = 1; i < static_cast<size_t>(OpKind::Count); i++) {
+            if (Precedence::table[i] != 0) {
+                SymbolId symbol = names.intern(Ops::spelling(static_cast<OpKind>(i)));
+                ops.resize(std::max<size_t>(ops.size(), symbol + 1), OpKind::None);
+                ops[symbol] = static_cast<OpKind>(i);
+            }
+        }
+    }
+
+public:
+    // Rewrites ast, which must have passed SemanticChecker, in place;
+    // names is the interner it was parsed with. Returns the number of nodes
+    // removed.
+    static NodeId fold(FlatAST& ast, Interner& names) {
+        ConstantFolder folder(ast, names);
+        // Children come after their parent, so a backward scan sees every
+        // operand before the op using it.
+        for (NodeId n = ast.size(); n-- > 0;) {
+            int32_t value;
+            if (ast.kinds[n] == ASTType::NumberLiteral && parseLiteral(ast.text(n), value)) {
+                folder.setConstant(n, value);
+            } else if (ast.kinds[n] == ASTType::BinaryOp) {
+                folder.foldBinary(n);
+            }
+        }
+        // Turn the marks into counts of rewrites before each node.
+        NodeId total = 0;
+        for (NodeId& r : folder.rewrites) {
+            NodeId mark = r;
+            r = total;
+            total += mark;
+        }
+        if (total == 0) {
+            return 0;
+        }
+        NodeId before = ast.size();
+        ast = folder.rebuild();
+        return before - ast.size();
+    }
+};
+
+// A diagnostic resolved to a source position for printing. Line 0 means the
+// error is not tied to a position (an unreadable file, a fatal limit).
+struct Message {
+    size_t line = 0;
+    size_t column = 0;
+    std::string text;
+    std::string file; // for --preprocess: the include the position is in, if not the input
+
+    Message() = default;
+    Message(size_t line, size_t column, std::string text, std::string file = "")
+        : line(line), column(column), text(std::move(text)), file(std::move(file)) {}
+};
+
+struct CheckResult {
+    bool ok = true;
+    std::vector<Message> errors;
+    bool truncated = false; // the error limit was hit and checking stopped early
+};
+
+// Parses and checks one translation unit. The arena and parser live only for
+// the duration of the call, so batch runs do not accumulate trees; onTree,
+// if set, sees the flat tree of an input that passed, and the interner it
+// was parsed with, before they go; it may rewrite both. With
+// stats, the phases are timed and the tree's sizes recorded.
+// Syntax errors do not stop the checker: the parser recovers and hands over
+// what it could build, so one run reports problems of both kinds.
+template <typename Source>
+static CheckResult checkSource(Source& src, ThreadPool* pool, size_t maxErrors,
+                               const std::function<void(FlatAST&, Interner&)>& onTree = nullptr,
+                               Stats* stats = nullptr) {
+    CheckResult result;
+    Diagnostics diagnostics(maxErrors);
+    try {
+        Interner names;
+        Arena arena; // owns the whole tree; released in one go at scope exit
+        Parser parser(src, arena, names, diagnostics);
+        if (pool) {
+            parser.lexInParallel(*pool);
+        }
+        PhaseTimer parsing(stats ? &stats->parse : nullptr);
+        if (stats) {
+            parser.collectStats(*stats);
+        }
+        ASTNode* tree = parser.parse();
+        FlatAST ast = flatten(tree, names, parser.nodeCount());
+        parsing.stop();
+
+        PhaseTimer checking(stats ? &stats->check : nullptr);
+        if (!diagnostics.full()) {
+            SemanticChecker::check(ast, diagnostics, pool);
+        }
+        checking.stop();
+        if (stats) {
+            // Lexing ran inside the parse timer; report the two apart.
+            stats->parse.wall -= stats->lex.wall;
+            stats->parse.cpu -= stats->lex.cpu;
+            stats->nodes = ast.size();
+            stats->symbols = names.size();
+            stats->symbolBytes = names.bytesUsed();
+            stats->arenaBytes = arena.bytesReserved();
+        }
+        if (onTree && diagnostics.empty()) {
+            onTree(ast, names);
+        }
+        diagnostics.sort();
+        for (const Diagnostic& d : diagnostics.all()) {
+            LineTable::Location loc = parser.lines().locate(d.offset);
+            result.errors.push_back({loc.line, loc.column, d.message});
+        }
+    } catch (const std::exception& e) {
+        // Only limits the tools cannot work past end up here; whatever was
+        // reported before is dropped along with the half-built tree.
+        result.errors.clear();
+        result.errors.push_back({0, 0, e.what()});
+    }
+    result.ok = result.errors.empty();
+    result.truncated = diagnostics.full() || diagnostics.droppedCount() != 0;
+    return result;
+}
+
+// XXH64, for cache keys: fast enough that hashing a file costs a small
+// fraction of lexing it. Reads words in host byte order, so keys are only
+// meaningful on the machine (or at least the endianness) that made them.
+namespace Hash {
+constexpr uint64_t P1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t P3 = 0x165667B19E3779F9ull;
+constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof v);
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * P2, 31) * P1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t v) {
+    return (acc ^ round(0, v)) * P1 + P4;
+}
+
+inline uint64_t xxh64(std::string_view data, uint64_t seed) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t h;
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + P5;
+    }
+    h += data.size();
+    for (; end - p >= 8; p += 8) {
+        h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    }
+    if (end - p >= 4) {
+        h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (static_cast<unsigned char>(*p) * P5), 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+}
+
+// Writes data to a temporary name next to path and renames it into place, so
+// concurrent readers never see half a file. False if it could not be
+// written; path is then left as it was.
+static bool replaceFile(const std::filesystem::path& path, std::string_view data) {
+    static std::atomic<uint64_t> counter{0};
+    std::filesystem::path temp = path;
+    temp += ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "-" +
+            std::to_string(counter++);
+    {
+        std::ofstream file(temp, std::ios::binary);
+        if (!file.write(data.data(), static_cast<std::streamsize>(data.size())) || !file.flush()) {
+            file.close();
+            std::error_code ec;
+            std::filesystem::remove(temp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Identifies the plsa build for the result cache. CMakeLists.txt sets it
+// from a hash of the sources and the compiler; other builds fall back to
+// the build time, which only tells builds apart without SOURCE_DATE_EPOCH.
+#ifndef PLSA_BUILD_ID
+#define PLSA_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+// Results of earlier runs, one file per distinct input under a cache
+// directory, so unchanged inputs skip lexing, parsing and checking.
+// Preprocessed sources are self-contained (includes are already expanded),
+// so a result depends only on the input's own bytes, the error limit and the
+// plsa build; all three go into the key. Any I/O failure just means a miss.
+class ResultCache {
+private:
+    std::filesystem::path dir;
+    uint64_t seed;
+
+    static constexpr int Format = 1; // entry layout; bump when it changes
+
+    std::filesystem::path entryPath(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof name, "%016llx.result", static_cast<unsigned long long>(key));
+        return dir / name;
+    }
+
+public:
+    explicit ResultCache(std::filesystem::path dir)
+        : dir(std::move(dir)),
+          // Any change to plsa may change results, so entries are tied to
+          // the build that wrote them.
+          seed(Hash::xxh64(PLSA_BUILD_ID, Format)) {}
+
+    // Creates the directory if needed; false if it cannot be used.
+    bool prepare() const {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        return std::filesystem::is_directory(dir, ec);
+    }
+
+    uint64_t key(std::string_view text, size_t maxErrors) const {
+        return Hash::xxh64(text, seed ^ (maxErrors * Hash::P3));
+    }
+
+    // Entry layout, all text:
+    //   plsa-cache <Format>
+    //   <input size> <truncated> <error count>
+    // then per error "<line> <column> <length>\n<message bytes>\n".
+    bool load(uint64_t key, size_t size, CheckResult& out) const {
+        std::ifstream file(entryPath(key), std::ios::binary);
+        std::string magic;
+        int format = 0;
+        size_t storedSize = 0, count = 0;
+        bool truncated = false;
+        if (!(file >> magic >> format >> storedSize >> truncated >> count) || magic != "plsa-cache" ||
+            format != Format || storedSize != size) {
+            return false;
+        }
+        CheckResult result;
+        for (size_t i = 0; i < count; i++) {
+            Message m;
+            size_t length = 0;
+            if (!(file >> m.line >> m.column >> length) || file.get() != '\n') {
+                return false;
+            }
+            m.text.resize(length);
+            if (!file.read(m.text.data(), static_cast<std::streamsize>(length))) {
+                return false;
+            }
+            result.errors.push_back(std::move(m));
+        }
+        result.ok = result.errors.empty();
+        result.truncated = truncated;
+        out = std::move(result);
+        return true;
+    }
+
+    // Concurrent runs never see half an entry; see replaceFile.
+    void store(uint64_t key, size_t size, const CheckResult& result) const {
+        std::string out = "plsa-cache " + std::to_string(Format) + "\n" + std::to_string(size) + " " +
+                          (result.truncated ? "1" : "0") + " " + std::to_string(result.errors.size()) + "\n";
+        for (const Message& m : result.errors) {
+            out += std::to_string(m.line) + " " + std::to_string(m.column) + " " + std::to_string(m.text.size()) +
+                   "\n" + m.text + "\n";
+        }
+        replaceFile(entryPath(key), out);
+    }
+};
+
+// The checked tree and its symbols as a file the compiler loads instead of
+// parsing the source again. All integers are little-endian u32 and every
+// section starts 4-byte aligned, so a reader can map the file and use the
+// arrays in place:
+//   header     "VAST", Version, flags, node count N, symbol count S,
+//              string bytes B, source size, source XXH64 (low word, high
+//              word); flag Folded marks a tree rewritten by ConstantFolder
+//   kinds      u8[N] ASTType values, zero-padded to a multiple of 4
+//   payloads   u32[N] symbol ids, 0 for none
+//   subtreeEnd u32[N] as in FlatAST
+//   offsets    u32[N] source offsets
+//   symbols    u32[S + 1] where each symbol's bytes start in strings; the
+//              last entry is B
+//   strings    u8[B]
+// Version changes whenever this layout or ASTType does.
+namespace AstFile {
+constexpr uint32_t Version = 2;
+constexpr size_t HeaderWords = 9;
+constexpr uint32_t Folded = 1;
+
+inline void putWord(std::string& out, uint32_t value) {
+    char bytes[4] = {static_cast<char>(value), static_cast<char>(value >> 8), static_cast<char>(value >> 16),
+                     static_cast<char>(value >> 24)};
+    out.append(bytes, 4);
+}
+
+inline void putWords(std::string& out, const std::vector<uint32_t>& values) {
+    uint32_t probe = 1;
+    if (std::memcmp(&probe, "\1\0\0\0", 4) == 0) { // little-endian host: the array is already in file order
+        out.append(reinterpret_cast<const char*>(values.data()), values.size() * 4);
+        return;
+    }
+    for (uint32_t value : values) {
+        putWord(out, value);
+    }
+}
+
+inline void putHeader(std::string& out, uint32_t flags, uint32_t nodes, uint32_t symbols, uint32_t stringBytes,
+                      std::string_view source) {
+    uint64_t hash = Hash::xxh64(source, 0);
+    out.append("VAST", 4);
+    for (uint32_t word : {Version, flags, nodes, symbols, stringBytes, static_cast<uint32_t>(source.size()),
+                          static_cast<uint32_t>(hash), static_cast<uint32_t>(hash >> 32)}) {
+        putWord(out, word);
+    }
+}
+
+// False if the file could not be written.
+inline bool write(const std::string& path, const FlatAST& ast, std::string_view source, uint32_t flags) {
+    const Interner& names = *ast.names;
+    std::vector<uint32_t> starts;
+    starts.reserve(names.size() + 1);
+    uint64_t stringBytes = 0;
+    for (SymbolId id = 0; id < names.size(); id++) {
+        starts.push_back(static_cast<uint32_t>(stringBytes));
+        stringBytes += names.name(id).size();
+    }
+    if (stringBytes > UINT32_MAX) {
+        return false;
+    }
+    starts.push_back(static_cast<uint32_t>(stringBytes));
+
+    std::string out;
+    out.reserve(HeaderWords * 4 + ast.size() * 13 + 3 + starts.size() * 4 + stringBytes);
+    putHeader(out, flags, ast.size(), static_cast<uint32_t>(names.size()), static_cast<uint32_t>(stringBytes), source);
+    for (ASTType kind : ast.kinds) {
+        out += static_cast<char>(kind);
+    }
+    out.append((4 - ast.size() % 4) % 4, '\0');
+    putWords(out, ast.payloads);
+    putWords(out, ast.subtreeEnd);
+    putWords(out, ast.offsets);
+    putWords(out, starts);
+    for (SymbolId id = 0; id < names.size(); id++) {
+        out += names.name(id);
+    }
+    return replaceFile(path, out);
+}
+
+// True if path holds a tree of this Version and flags for exactly this
+// source, so a cached result needs no reparse to produce it.
+inline bool current(const std::string& path, std::string_view source, uint32_t flags) {
+    std::ifstream file(path, std::ios::binary);
+    char header[HeaderWords * 4];
+    if (!file.read(header, sizeof header)) {
+        return false;
+    }
+    std::string expected;
+    putHeader(expected, flags, 0, 0, 0, source);
+    auto same = [&](size_t word) { return std::memcmp(header + word * 4, expected.data() + word * 4, 4) == 0; };
+    return same(0) && same(1) && same(2) && same(6) && same(7) && same(8);
+}
+}
+
+// checkSource for an in-memory input, answered from the cache when it has
+// seen the same bytes before. With astPath a passing input's tree is also
+// written there (see AstFile), constant-folded with fold; a cached pass
+// still parses unless the file already holds this input's tree.
+static CheckResult checkText(std::string_view text, ThreadPool* pool, size_t maxErrors, const ResultCache* cache,
+                             const std::string& astPath = "", bool fold = false, Stats* stats = nullptr) {
+    bool written = true;
+    uint32_t flags = fold ? AstFile::Folded : 0;
+    std::function<void(FlatAST&, Interner&)> onTree;
+    if (!astPath.empty()) {
+        onTree = [&](FlatAST& ast, Interner& names) {
+            if (fold) {
+                ConstantFolder::fold(ast, names);
+            }
+            written = AstFile::write(astPath, ast, text, flags);
+        };
+    }
+    uint64_t key = cache ? cache->key(text, maxErrors) : 0;
+    CheckResult result;
+    if (cache && cache->load(key, text.size(), result) &&
+        (astPath.empty() || !result.ok || AstFile::current(astPath, text, flags))) {
+        if (stats) {
+            stats->cached = true;
+        }
+        return result;
+    }
+    result = checkSource(text, pool, maxErrors, onTree, stats);
+    if (cache) {
+        cache->store(key, text.size(), result);
+    }
+    if (!written) {
+        result.ok = false;
+        result.errors.push_back({0, 0, "Could not write AST file: " + astPath});
+    }
+    return result;
+}
+
+static CheckResult checkPath(const std::string& path, ThreadPool* pool, size_t maxErrors, const ResultCache* cache) {
+    SourceBuffer source;
+    if (!source.open(path.c_str())) {
+        CheckResult result;
+        result.ok = false;
+        result.errors.push_back({0, 0, "Could not open file: " + path});
+        return result;
+    }
+    return checkText(source.text(), pool, maxErrors, cache);
+}
+
+// Which included files check clean on their own, shared by every input of
+// a run (and, through the result cache, by later runs). Vira functions only
+// refer to their own locals, so a header exports nothing the checker needs
+// to look up: all a summary records is whether the header's functions pass.
+// Keyed on the include's path and its preprocessed text, since the defines
+// in effect where it is included can change that text. Two inputs that miss
+// on the same header at once may both check it.
+class IncludeSummaries {
+private:
+    size_t maxErrors;
+    const ResultCache* cache;
+    std::mutex lock;
+    std::unordered_map<std::string, bool> passed;
+
+public:
+    IncludeSummaries(size_t maxErrors, const ResultCache* cache) : maxErrors(maxErrors), cache(cache) {}
+
+    bool clean(const std::string& path, std::string_view text) {
+        std::string key = path + '\n' + std::to_string(Hash::xxh64(text, 0));
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = passed.find(key);
+            if (found != passed.end()) {
+                return found->second;
+            }
+        }
+        bool ok = checkText(text, nullptr, maxErrors, cache).ok;
+        std::lock_guard<std::mutex> guard(lock);
+        passed.emplace(std::move(key), ok);
+        return ok;
+    }
+};
+
+// In-process counterpart of source/preprocessor, so a source can be
+// preprocessed and checked in one run without a pipe or a .pre file in
+// between. It handles the same directives: #include "file" and <file>,
+// #define NAME value (object-like, replaced on later lines without
+// rescanning) and #undef; other directives are passed through. Unlike the
+// standalone tool it reads an include where the directive is, stops at the
+// end of the main file, leaves string literals alone and has no line length
+// limit. Quoted includes are looked up next to the including file first.
+//
+// Every output line comes from one source line. The preprocessor records
+// which, and where macros changed its columns, so that locate() can map a
+// message about text() back to the file the code came from.
+//
+// With summaries, an include that starts between functions and checks clean
+// on its own (see IncludeSummaries) is left out of text(): functions are
+// checked independently, so the rest checks the same without it. That only
+// holds while the rest is clean too; for a text with errors, compare the
+// result of a run without summaries (see checkPreprocessed).
+class Preprocessor {
+private:
+    static constexpr size_t MaxIncludeDepth = 16; // counting the main file
+    static constexpr const char* SystemPaths[] = {"/usr/include", "."};
+
+    struct Line {
+        uint32_t file;
+        uint32_t line;
+        uint32_t firstShift; // this line's shifts end where the next line's begin
+    };
+
+    // One replaced macro name: columns [outBegin, outEnd) of the output line
+    // came from [srcBegin, srcEnd) of the source line. Columns are 0-based.
+    struct Shift {
+        uint32_t outBegin, outEnd;
+        uint32_t srcBegin, srcEnd;
+    };
+
+    std::vector<std::string> files; // files[0] is the main file
+    std::vector<std::unique_ptr<SourceBuffer>> buffers;
+    std::unordered_map<std::string_view, std::string> defines;
+    Arena names; // define names, which outlive the line they were read from
+    std::string out;
+    std::vector<Line> lines;
+    std::vector<Shift> shifts;
+    LineTable::Location end{1, 1}; // where the main file ends
+    std::vector<Message> failures;
+    IncludeSummaries* summaries;
+    int depth = 0; // of braces in out, outside string literals
+    bool dropped = false;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    static bool isIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+    static bool isIdent(char c) { return isIdentStart(c) || (c >= '0' && c <= '9'); }
+
+    static std::string_view trim(std::string_view s) {
+        while (!s.empty() && isSpace(s.front())) {
+            s.remove_prefix(1);
+        }
+        while (!s.empty() && isSpace(s.back())) {
+            s.remove_suffix(1);
+        }
+        return s;
+    }
+
+    // Strips word off the front of s if it is there as a whole word.
+    static bool directive(std::string_view& s, std::string_view word) {
+        if (s.substr(0, word.size()) != word || (s.size() > word.size() && isIdent(s[word.size()]))) {
+            return false;
+        }
+        s = trim(s.substr(word.size()));
+        return true;
+    }
+
+    bool fail(uint32_t file, uint32_t line, std::string text) {
+        failures.push_back({line, 1, std::move(text), file == 0 ? std::string() : files[file]});
+        return false;
+    }
+
+    // Between functions, as far as the text can tell: the last thing out is
+    // a '}' back at depth 0, or nothing at all. Any text for which that is
+    // wrong has errors anyway.
+    bool betweenFunctions() const {
+        size_t last = out.find_last_not_of(" \t\r\n");
+        return depth == 0 && (last == std::string::npos || out[last] == '}');
+    }
+
+    void emit(uint32_t file, uint32_t line, std::string_view text) {
+        lines.push_back({file, line, static_cast<uint32_t>(shifts.size())});
+        out += text;
+        out += '\n';
+    }
+
+    void expand(uint32_t file, uint32_t line, std::string_view text) {
+        lines.push_back({file, line, static_cast<uint32_t>(shifts.size())});
+        size_t lineStart = out.size();
+        size_t i = 0;
+        while (i < text.size()) {
+            size_t begin = i;
+            if (text[i] == '"') {
+                // Up to the closing quote, or the end of the line for an
+                // unterminated literal, which the lexer reports.
+                for (i++; i < text.size() && text[i] != '"'; i++) {
+                    i += text[i] == '\\' && i + 1 < text.size() ? 1 : 0;
+                }
+                i = std::min(i + 1, text.size());
+            } else if (isIdentStart(text[i])) {
+                while (i < text.size() && isIdent(text[i])) {
+                    i++;
+                }
+                auto define = defines.find(text.substr(begin, i - begin));
+                if (define != defines.end()) {
+                    uint32_t outBegin = static_cast<uint32_t>(out.size() - lineStart);
+                    out += define->second;
+                    shifts.push_back({outBegin, static_cast<uint32_t>(out.size() - lineStart),
+                                      static_cast<uint32_t>(begin), static_cast<uint32_t>(i)});
+                    continue;
+                }
+            } else {
+                // Digits and punctuation; identifiers right after digits are
+                // still expanded, as the lexer reads them as separate tokens.
+                for (; i < text.size() && text[i] != '"' && !isIdentStart(text[i]); i++) {
+                    depth += text[i] == '{' ? 1 : text[i] == '}' ? -1 : 0;
+                }
+            }
+            out.append(text.data() + begin, i - begin);
+        }
+        out += '\n';
+    }
+
+    std::string resolve(std::string_view name, bool system, uint32_t from) {
+        std::error_code ec;
+        if (system) {
+            for (const char* dir : SystemPaths) {
+                std::filesystem::path path = std::filesystem::path(dir) / name;
+                if (std::filesystem::is_regular_file(path, ec)) {
+                    return path.string();
+                }
+            }
+            return "";
+        }
+        std::filesystem::path beside = std::filesystem::path(files[from]).parent_path() / name;
+        if (std::filesystem::is_regular_file(beside, ec)) {
+            return beside.string();
+        }
+        return std::filesystem::is_regular_file(name, ec) ? std::string(name) : "";
+    }
+
+    bool process(uint32_t file, size_t includeDepth) {
+        std::string_view text = buffers[file]->text();
+        uint32_t line = 1;
+        for (size_t pos = 0; pos < text.size(); line++) {
+            size_t newline = text.find('\n', pos);
+            size_t stop = newline == std::string_view::npos ? text.size() : newline;
+            std::string_view content = text.substr(pos, stop - pos);
+            pos = stop + 1;
+            std::string_view rest = trim(content);
+            if (rest.empty() || rest[0] != '#') {
+                expand(file, line, content);
+                continue;
+            }
+            rest = trim(rest.substr(1));
+            if (directive(rest, "include")) {
+                char close = rest.empty() ? 0 : rest[0] == '<' ? '>' : rest[0] == '"' ? '"' : 0;
+                size_t closeAt = close ? rest.find(close, 1) : std::string_view::npos;
+                if (closeAt == std::string_view::npos) {
+                    return fail(file, line, "Invalid include");
+                }
+                std::string_view name = rest.substr(1, closeAt - 1);
+                std::string path = resolve(name, close == '>', file);
+                auto buffer = std::make_unique<SourceBuffer>();
+                if (path.empty() || !buffer->open(path.c_str())) {
+                    return fail(file, line, "Cannot open include: " + std::string(name));
+                }
+                if (includeDepth >= MaxIncludeDepth) {
+                    return fail(file, line, "Include depth exceeded");
+                }
+                files.push_back(path);
+                buffers.push_back(std::move(buffer));
+                size_t outMark = out.size(), linesMark = lines.size(), shiftsMark = shifts.size();
+                bool droppable = summaries && betweenFunctions();
+                if (!process(static_cast<uint32_t>(files.size() - 1), includeDepth + 1)) {
+                    return false;
+                }
+                if (droppable && summaries->clean(path, std::string_view(out).substr(outMark))) {
+                    out.resize(outMark);
+                    lines.resize(linesMark);
+                    shifts.resize(shiftsMark);
+                    depth = 0;
+                    dropped = true;
+                }
+            } else if (directive(rest, "define")) {
+                size_t nameEnd = 0;
+                while (nameEnd < rest.size() && !isSpace(rest[nameEnd])) {
+                    nameEnd++;
+                }
+                if (nameEnd != 0) {
+                    defines[names.copy(rest.substr(0, nameEnd))] = std::string(trim(rest.substr(nameEnd)));
+                }
+            } else if (directive(rest, "undef")) {
+                defines.erase(rest);
+            } else {
+                emit(file, line, content);
+            }
+        }
+        if (file == 0) {
+            size_t lastLine = text.rfind('\n');
+            size_t newlines = static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+            end = {newlines + 1, text.size() - (lastLine == std::string_view::npos ? 0 : lastLine + 1) + 1};
+        }
+        return true;
+    }
+
+public:
+    explicit Preprocessor(IncludeSummaries* summaries = nullptr) : summaries(summaries) {}
+
+    // Preprocesses path; false if it or an include could not be read, with
+    // the reasons in errors().
+    bool run(const std::string& path) {
+        files.assign(1, path);
+        buffers.push_back(std::make_unique<SourceBuffer>());
+        if (!buffers[0]->open(path.c_str())) {
+            failures.push_back({0, 0, "Could not open file: " + path});
+            return false;
+        }
+        out.reserve(buffers[0]->text().size() + buffers[0]->text().size() / 8);
+        return process(0, 1);
+    }
+
+    std::string_view text() const { return out; }
+    const std::vector<Message>& errors() const { return failures; }
+    bool droppedIncludes() const { return dropped; }
+
+    // Turns a position in text() into one in the file the line came from;
+    // the file is left empty for the main file. The end of the output maps
+    // to the end of the main file.
+    void locate(Message& m) const {
+        if (m.line == 0) {
+            return;
+        }
+        if (m.line > lines.size()) {
+            m.line = end.line;
+            m.column = end.column;
+            return;
+        }
+        const Line& line = lines[m.line - 1];
+        size_t shiftsEnd = m.line < lines.size() ? lines[m.line].firstShift : shifts.size();
+        size_t column = m.column - 1;
+        size_t moved = column;
+        for (size_t i = line.firstShift; i < shiftsEnd && shifts[i].outBegin <= column; i++) {
+            // Inside a replacement the position is the macro name's.
+            moved = column < shifts[i].outEnd ? shifts[i].srcBegin : column - shifts[i].outEnd + shifts[i].srcEnd;
+        }
+        m.line = line.line;
+        m.column = moved + 1;
+        m.file = line.file == 0 ? std::string() : files[line.file];
+    }
+};
+
+// checkText for path after preprocessing, with positions mapped back to the
+// sources. The cache and the AST file are keyed on the preprocessed text,
+// which is what gets compiled; prePath, if set, receives that text. With
+// summaries, clean includes are not checked again (see Preprocessor). An
+// input that then fails is checked again in full, so its report is the
+// same. Summaries are not used with prePath or astPath, which need the
+// whole text, nor with stats: their checks would count as preprocessing,
+// and the figures would describe the text left after dropping includes.
+static CheckResult checkPreprocessed(const std::string& path, ThreadPool* pool, size_t maxErrors,
+                                     const ResultCache* cache, IncludeSummaries* summaries,
+                                     const std::string& prePath = "", const std::string& astPath = "",
+                                     bool fold = false, Stats* stats = nullptr) {
+    if (!prePath.empty() || !astPath.empty() || stats) {
+        summaries = nullptr;
+    }
+    CheckResult result;
+    auto preprocessor = std::make_unique<Preprocessor>(summaries);
+    PhaseTimer preprocessing(stats ? &stats->preprocess : nullptr);
+    bool preprocessed = preprocessor->run(path);
+    preprocessing.stop();
+    if (!preprocessed) {
+        result.ok = false;
+        result.errors = preprocessor->errors();
+        return result;
+    }
+    if (!prePath.empty() && !replaceFile(prePath, preprocessor->text())) {
+        result.ok = false;
+        result.errors.push_back({0, 0, "Could not write preprocessed file: " + prePath});
+        return result;
+    }
+    result = checkText(preprocessor->text(), pool, maxErrors, cache, astPath, fold, stats);
+    if (!result.ok && preprocessor->droppedIncludes()) {
+        if (stats) {
+            // Only the full pass is reported.
+            Stats::Phase total = stats->total;
+            *stats = Stats();
+            stats->total = total;
+        }
+        preprocessor = std::make_unique<Preprocessor>();
+        PhaseTimer again(stats ? &stats->preprocess : nullptr);
+        preprocessor->run(path);
+        again.stop();
+        result = checkText(preprocessor->text(), pool, maxErrors, cache, astPath, fold, stats);
+    }
+    for (Message& m : result.errors) {
+        preprocessor->locate(m);
+    }
+    return result;
+}
+
+static std::string formatMessage(const Message& m) {
+    if (m.line == 0) {
+        return m.text;
+    }
+    std::string where = m.file.empty() ? "" : " in " + m.file;
+    return m.text + " at line " + std::to_string(m.line) + ", column " + std::to_string(m.column) + where;
+}
+
+static std::string jsonEscape(std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += hex[(c >> 4) & 0xf];
+                    out += hex[c & 0xf];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// Appends the paths listed in a response file, one per line; blank lines
+// are skipped.
+static bool readResponseFile(const std::string& path, std::vector<std::string>& inputs) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            continue;
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(begin, end - begin + 1));
+    }
+    return true;
+}
+
+// Appends "ok" and, for a failed check, "errors" and "truncated" as JSON
+// object members, in the layout described at runBatch.
+static void appendResultFields(std::string& out, const CheckResult& result) {
+    out += "\"ok\":";
+    out += result.ok ? "true" : "false";
+    if (result.ok) {
+        return;
+    }
+    out += ",\"errors\":[";
+    for (size_t e = 0; e < result.errors.size(); e++) {
+        const Message& m = result.errors[e];
+        out += e == 0 ? "{" : ",{";
+        out += "\"line\":" + std::to_string(m.line) + ",\"column\":" + std::to_string(m.column);
+        if (!m.file.empty()) {
+            out += ",\"include\":\"" + jsonEscape(m.file) + "\"";
+        }
+        out += ",\"message\":\"" + jsonEscape(m.text) + "\"}";
+    }
+    out += "]";
+    if (result.truncated) {
+        out += ",\"truncated\":true";
+    }
+}
+
+// Warms the page cache for batch inputs a window ahead of the workers, so
+// that on a cold cache reading the next files overlaps with checking the
+// current ones instead of each worker stalling on its own page faults. One
+// thread is enough: where the OS takes read-ahead advice the requests
+// return at once and the reads run in the kernel; elsewhere the thread
+// reads the files itself, which at least keeps the waiting off the workers.
+class Prefetcher {
+private:
+    const std::vector<std::string>& paths;
+    size_t window;
+    size_t started = 0; // inputs up to here have been picked up by a worker
+    bool stopping = false;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread reader;
+
+    static void warm(const std::string& path) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            ::close(fd);
+        }
+#else
+        static thread_local std::vector<char> scratch(1 << 20);
+        if (FILE* file = std::fopen(path.c_str(), "rb")) {
+            while (std::fread(scratch.data(), 1, scratch.size(), file) == scratch.size()) {
+            }
+            std::fclose(file);
+        }
+#endif
+    }
+
+    void run() {
+        for (size_t i = 0; i < paths.size(); i++) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || i < started + window; });
+                if (stopping) {
+                    return;
+                }
+            }
+            warm(paths[i]);
+        }
+    }
+
+public:
+    Prefetcher(const std::vector<std::string>& paths, size_t window)
+        : paths(paths), window(window), reader([this] { run(); }) {}
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        reader.join();
+    }
+
+    // Called as a worker starts on input i.
+    void begin(size_t i) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            started = std::max(started, i + 1);
+        }
+        wake.notify_one();
+    }
+};
+
+// Prints lines that are produced out of order in their given order, each
+// as soon as all the ones before it are in, and writes them in large
+// chunks rather than line by line.
+class OrderedOutput {
+private:
+    static constexpr size_t ChunkBytes = 64 * 1024;
+
+    std::ostream& stream;
+    std::mutex lock;
+    std::vector<std::string> waiting; // lines that arrived before an earlier one
+    std::vector<bool> arrived;
+    size_t next = 0;
+    std::string buffer;
+
+public:
+    OrderedOutput(std::ostream& stream, size_t count) : stream(stream), waiting(count), arrived(count) {}
+
+    void put(size_t i, std::string line) {
+        std::lock_guard<std::mutex> guard(lock);
+        waiting[i] = std::move(line);
+        arrived[i] = true;
+        for (; next < arrived.size() && arrived[next]; next++) {
+            buffer += waiting[next];
+            std::string().swap(waiting[next]);
+        }
+        if (buffer.size() >= ChunkBytes) {
+            stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            stream.flush();
+            buffer.clear();
+        }
+    }
+
+    // Writes out what is left, then tail. Every line must be in.
+    void finish(std::string_view tail) {
+        std::lock_guard<std::mutex> guard(lock);
+        buffer += tail;
+        stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        stream.flush();
+        buffer.clear();
+    }
+};
+
+// Batch mode checks every input in this one process and prints one JSON
+// object per file, in input order, e.g.
+//   {"file":"a.pre","ok":true}
+//   {"file":"b.pre","ok":false,"errors":[{"line":3,"column":9,"message":"Undefined identifier: x"}]}
+// followed by a summary line. "truncated":true marks a file that hit
+// --max-errors. With --preprocess, an error in an included file names it in
+// "include". The exit status is 0 only if all files passed.
+// Files are checked in parallel, but results are always printed in the
+// order the inputs were given, each as soon as the inputs before it are
+// done. The next inputs are read ahead while the current ones are checked.
+static int runBatch(const std::vector<std::string>& inputs, ThreadPool& pool, size_t maxErrors,
+                    const ResultCache* cache, bool preprocess) {
+    IncludeSummaries summaries(maxErrors, cache);
+    OrderedOutput output(std::cout, inputs.size());
+    std::atomic<size_t> failed(0);
+    {
+        Prefetcher prefetcher(inputs, std::max<size_t>(8, pool.size() * 4));
+        pool.parallelFor(inputs.size(), [&](size_t i) {
+            prefetcher.begin(i);
+            CheckResult result = preprocess ? checkPreprocessed(inputs[i], &pool, maxErrors, cache, &summaries)
+                                            : checkPath(inputs[i], &pool, maxErrors, cache);
+            std::string line = "{\"file\":\"" + jsonEscape(inputs[i]) + "\",";
+            appendResultFields(line, result);
+            line += "}\n";
+            failed += result.ok ? 0 : 1;
+            output.put(i, std::move(line));
+        });
+    }
+    output.finish("{\"files\":" + std::to_string(inputs.size()) + ",\"failed\":" + std::to_string(failed) + "}\n");
+    return failed == 0 ? 0 : 1;
+}
+
+// Just enough JSON to read server requests: one flat object whose values
+// are strings, numbers, booleans or null. Strings are decoded; any other
+// value is kept as its raw text. Nested objects and arrays are rejected.
+namespace Json {
+struct Value {
+    std::string text;
+    bool isString;
+};
+
+using Object = std::unordered_map<std::string, Value>;
+
+inline void skipSpace(std::string_view s, size_t& i) {
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) {
+        i++;
+    }
+}
+
+inline void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+inline bool readHex4(std::string_view s, size_t& i, uint32_t& out) {
+    if (i + 4 > s.size()) {
+        return false;
+    }
+    out = 0;
+    for (size_t end = i + 4; i < end; i++) {
+        char c = s[i];
+        uint32_t digit = c >= '0' && c <= '9'   ? c - '0'
+                         : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                         : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                                : 16;
+        if (digit == 16) {
+            return false;
+        }
+        out = out * 16 + digit;
+    }
+    return true;
+}
+
+// Reads the string starting at the '"' at s[i].
+inline bool readString(std::string_view s, size_t& i, std::string& out) {
+    for (i++; i < s.size();) {
+        char c = s[i++];
+        if (c == '"') {
+            return true;
+        }
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (i == s.size()) {
+            return false;
+        }
+        switch (s[i++]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t cp;
+                if (!readHex4(s, i, cp)) {
+                    return false;
+                }
+                uint32_t low;
+                if (cp >= 0xD800 && cp < 0xDC00 && s.substr(i, 2) == "\\u") {
+                    size_t j = i + 2;
+                    if (readHex4(s, j, low) && low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        i = j;
+                    }
+                }
+                appendUtf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
+inline bool parseObject(std::string_view s, Object& out) {
+    size_t i = 0;
+    skipSpace(s, i);
+    if (i == s.size() || s[i] != '{') {
+        return false;
+    }
+    i++;
+    skipSpace(s, i);
+    if (i < s.size() && s[i] == '}') {
+        i++;
+    } else {
+        for (;;) {
+            std::string key;
+            skipSpace(s, i);
+            if (i == s.size() || s[i] != '"' || !readString(s, i, key)) {
+                return false;
+            }
+            skipSpace(s, i);
+            if (i == s.size() || s[i] != ':') {
+                return false;
+            }
+            i++;
+            skipSpace(s, i);
+            Value value{"", i < s.size() && s[i] == '"'};
+            if (value.isString) {
+                if (!readString(s, i, value.text)) {
+                    return false;
+                }
+            } else {
+                size_t start = i;
+                while (i < s.size() && (std::isalnum(static_cast<unsigned char>(s[i])) || s[i] == '-' ||
+                                        s[i] == '+' || s[i] == '.')) {
+                    i++;
+                }
+                if (i == start) {
+                    return false;
+                }
+                value.text = std::string(s.substr(start, i - start));
+            }
+            out[key] = std::move(value);
+            skipSpace(s, i);
+            if (i < s.size() && s[i] == ',') {
+                i++;
+                continue;
+            }
+            if (i < s.size() && s[i] == '}') {
+                i++;
+                break;
+            }
+            return false;
+        }
+    }
+    skipSpace(s, i);
+    return i == s.size();
+}
+}
+
+// Long-running mode for editors and build tools: reads one JSON request per
+// line on stdin and answers each with one JSON line on stdout, in order.
+//   {"id":1,"method":"check","file":"a.pre"}            check the file on disk
+//   {"id":2,"method":"check","file":"a.pre","text":"…"}  check unsaved text
+//   {"id":3,"method":"edit","file":"a.pre","start":120,"end":124,"text":"…"}
+//                                                       replace bytes [start, end)
+//   {"id":4,"method":"invalidate","file":"a.pre"}       forget the file
+//   {"id":5,"method":"stats"}                           memory in use
+//   {"id":6,"method":"shutdown"}
+// A check answers {"id":1,"ok":...} with errors as in batch mode. Results
+// are remembered per file with the content's hash, so checking unchanged
+// content again is a hash away. Each file's text and parsed tree are kept
+// too, as long as all of them fit in the memory budget; the least recently
+// checked ones are dropped first, while their results stay. An edit applies
+// to the kept text and answers like a check, with "incremental":true when
+// only the functions around the edit were reparsed.
+class Server {
+private:
+    struct Unit {
+        std::string text; // current content, which edits apply to
+        Interner names;   // owns its spellings, so editing text leaves them valid
+        bool parsed = false; // false for text whose result came from the cache
+        bool complete = false; // diagnostics holds every error, not just the first maxErrors
+        bool openEnd = false;  // the parse ran into the end of text (Parser::reachedEnd)
+        FlatAST ast;
+        std::vector<FunctionSpan> functions; // one per Program child, in order
+        std::vector<Diagnostic> diagnostics; // in source order
+        size_t reparsed = 0; // bytes reparsed by edits since the last full parse
+
+        size_t bytesUsed() const {
+            return text.capacity() + names.bytesUsed() + ast.bytesUsed() +
+                   functions.capacity() * sizeof(FunctionSpan) + diagnostics.capacity() * sizeof(Diagnostic);
+        }
+    };
+
+    struct Entry {
+        bool checked = false;
+        uint64_t hash = 0;
+        size_t size = 0;
+        CheckResult result;
+        std::unique_ptr<Unit> unit;              // null once evicted
+        std::list<std::string>::iterator recent; // position in lru, valid while unit is set
+    };
+
+    // One parse-and-check pass, with offsets relative to the text it saw.
+    struct Pass {
+        FlatAST ast;
+        std::vector<FunctionSpan> functions;
+        Diagnostics diagnostics;
+        bool reachedEnd = false;
+
+        explicit Pass(size_t maxErrors) : diagnostics(maxErrors) {}
+    };
+
+    ThreadPool& pool;
+    size_t maxErrors;
+    const ResultCache* cache;
+    size_t budget;
+    std::unordered_map<std::string, Entry> files;
+    std::list<std::string> lru; // files holding a unit, most recently used first
+    size_t unitBytes = 0;
+
+    void dropUnit(Entry& entry) {
+        if (entry.unit) {
+            unitBytes -= entry.unit->bytesUsed();
+            entry.unit.reset();
+            lru.erase(entry.recent);
+        }
+    }
+
+    void evict() {
+        while (unitBytes > budget && !lru.empty()) {
+            dropUnit(files[lru.back()]);
+        }
+    }
+
+    void keep(const std::string& file, Entry& entry, std::unique_ptr<Unit> unit) {
+        unitBytes += unit->bytesUsed();
+        entry.unit = std::move(unit);
+        lru.push_front(file);
+        entry.recent = lru.begin();
+        evict();
+    }
+
+    void analyze(std::string_view text, Interner& names, Pass& pass) {
+        Arena arena;
+        Parser parser(text, arena, names, pass.diagnostics, true);
+        parser.recordFunctions(pass.functions);
+        ASTNode* tree = parser.parse();
+        pass.reachedEnd = parser.reachedEnd();
+        pass.ast = flatten(tree, names, parser.nodeCount());
+        if (!pass.diagnostics.full()) {
+            SemanticChecker::check(pass.ast, pass.diagnostics, &pool);
+        }
+        pass.diagnostics.sort();
+    }
+
+    static CheckResult resolve(const Unit& unit) {
+        LineTable lines;
+        lines.indexLazily(unit.text);
+        CheckResult result;
+        for (const Diagnostic& d : unit.diagnostics) {
+            LineTable::Location loc = lines.locate(d.offset);
+            result.errors.push_back({loc.line, loc.column, d.message});
+        }
+        result.ok = result.errors.empty();
+        result.truncated = !unit.complete;
+        return result;
+    }
+
+    // Parses and checks text from scratch, as checkSource does. After a
+    // fatal limit only the text is kept.
+    std::unique_ptr<Unit> build(std::string text, CheckResult& result) {
+        auto unit = std::make_unique<Unit>();
+        unit->text = std::move(text);
+        try {
+            Pass pass(maxErrors);
+            analyze(unit->text, unit->names, pass);
+            unit->ast = std::move(pass.ast);
+            unit->functions = std::move(pass.functions);
+            unit->diagnostics = pass.diagnostics.all();
+            unit->complete = !pass.diagnostics.full() && pass.diagnostics.droppedCount() == 0;
+            unit->openEnd = pass.reachedEnd;
+            unit->parsed = true;
+            result = resolve(*unit);
+        } catch (const std::exception& e) {
+            result = CheckResult();
+            result.ok = false;
+            result.errors.push_back({0, 0, e.what()});
+        }
+        return unit;
+    }
+
+    // After unit.text had [start, end) replaced by length bytes, reparses
+    // only from the end of the last function before the edit to the start
+    // of the first one after it, and splices the result in. Those function
+    // boundaries are safe restart points: the lexer is between tokens and
+    // outside any string there, and the parser at top level. False, with
+    // unit unchanged, when a full parse is needed instead: the edit left
+    // the region's last function or string open, so it now runs on into
+    // the next, or the errors no longer all fit under the limit.
+    bool reparse(Unit& unit, size_t start, size_t end, size_t length, size_t oldSize) {
+        if (!unit.parsed || !unit.complete || unit.text.size() > UINT32_MAX) {
+            return false;
+        }
+        const std::vector<FunctionSpan>& spans = unit.functions;
+        size_t first = std::lower_bound(spans.begin(), spans.end(), start,
+                                        [](const FunctionSpan& f, size_t at) { return f.end < at; }) -
+                       spans.begin();
+        if (unit.openEnd && first == spans.size() && first > 0) {
+            first--; // the last function may have ended only because the text did
+        }
+        size_t after = std::upper_bound(spans.begin(), spans.end(), end,
+                                        [](size_t at, const FunctionSpan& f) { return at < f.begin; }) -
+                       spans.begin();
+        size_t from = first > 0 ? spans[first - 1].end : 0;
+        size_t to = after < spans.size() ? spans[after].begin : oldSize;
+        int64_t delta = static_cast<int64_t>(length) - static_cast<int64_t>(end - start);
+        std::string_view region(unit.text.data() + from, static_cast<size_t>(static_cast<int64_t>(to) + delta) - from);
+        // Stale spellings pile up in the interner, so once edits have
+        // reparsed as much as the whole file, start over.
+        if (unit.reparsed + region.size() > unit.text.size()) {
+            return false;
+        }
+
+        Pass pass(maxErrors);
+        analyze(region, unit.names, pass);
+        bool last = after == spans.size(); // the region runs to the real end of input
+        if ((pass.reachedEnd && !last) || pass.diagnostics.full()) {
+            return false;
+        }
+
+        std::vector<Diagnostic> diagnostics;
+        for (const Diagnostic& d : unit.diagnostics) {
+            if (d.offset < from) {
+                diagnostics.push_back(d);
+            }
+        }
+        for (const Diagnostic& d : pass.diagnostics.all()) {
+            diagnostics.push_back({static_cast<uint32_t>(d.offset + from), d.message});
+        }
+        for (const Diagnostic& d : unit.diagnostics) {
+            if (d.offset >= to && !last) {
+                diagnostics.push_back({static_cast<uint32_t>(d.offset + delta), d.message});
+            }
+        }
+        if (diagnostics.size() >= maxErrors) {
+            return false;
+        }
+
+        const FlatAST& old = unit.ast;
+        NodeId firstNode = old.size(), afterNode = old.size();
+        size_t i = 0;
+        for (NodeId c = old.firstChild(0); c < old.size(); c = old.nextSibling(c), i++) {
+            if (i == first) {
+                firstNode = c;
+            }
+            if (i == after) {
+                afterNode = c;
+                break;
+            }
+        }
+        const FlatAST& part = pass.ast;
+        size_t size = size_t(firstNode) + (part.size() - 1) + (old.size() - afterNode);
+        if (size > UINT32_MAX) {
+            return false;
+        }
+        FlatAST ast;
+        ast.names = &unit.names;
+        ast.kinds.reserve(size);
+        ast.payloads.reserve(size);
+        ast.subtreeEnd.reserve(size);
+        ast.offsets.reserve(size);
+        auto copy = [&](const FlatAST& src, NodeId begin, NodeId stop, int64_t nodeShift, int64_t offsetShift) {
+            ast.kinds.insert(ast.kinds.end(), src.kinds.begin() + begin, src.kinds.begin() + stop);
+            ast.payloads.insert(ast.payloads.end(), src.payloads.begin() + begin, src.payloads.begin() + stop);
+            for (NodeId n = begin; n < stop; n++) {
+                ast.subtreeEnd.push_back(static_cast<NodeId>(src.subtreeEnd[n] + nodeShift));
+                ast.offsets.push_back(static_cast<uint32_t>(src.offsets[n] + offsetShift));
+            }
+        };
+        copy(old, 0, firstNode, 0, 0);
+        copy(part, 1, part.size(), int64_t(firstNode) - 1, static_cast<int64_t>(from));
+        copy(old, afterNode, old.size(), int64_t(firstNode) + part.size() - 1 - afterNode, delta);
+        ast.subtreeEnd[0] = ast.size();
+        if (first == 0) {
+            ast.offsets[0] = static_cast<uint32_t>(part.offsets[0] + from);
+        }
+
+        std::vector<FunctionSpan> functions(spans.begin(), spans.begin() + first);
+        for (const FunctionSpan& f : pass.functions) {
+            functions.push_back({static_cast<uint32_t>(f.begin + from), static_cast<uint32_t>(f.end + from)});
+        }
+        for (size_t f = after; f < spans.size(); f++) {
+            functions.push_back({static_cast<uint32_t>(spans[f].begin + delta), static_cast<uint32_t>(spans[f].end + delta)});
+        }
+
+        unit.ast = std::move(ast);
+        unit.functions = std::move(functions);
+        unit.diagnostics = std::move(diagnostics);
+        unit.reparsed += region.size();
+        unit.openEnd = last ? pass.reachedEnd : unit.openEnd;
+        return true;
+    }
+
+    const CheckResult& check(const std::string& file, std::string text) {
+        Entry& entry = files[file];
+        uint64_t hash = Hash::xxh64(text, 0);
+        if (entry.checked && entry.size == text.size() && entry.hash == hash) {
+            if (entry.unit) {
+                lru.splice(lru.begin(), lru, entry.recent);
+            } else {
+                auto unit = std::make_unique<Unit>(); // just the text, for edits
+                unit->text = std::move(text);
+                keep(file, entry, std::move(unit));
+            }
+            return entry.result;
+        }
+        dropUnit(entry);
+        entry.checked = true;
+        entry.hash = hash;
+        entry.size = text.size();
+        uint64_t key = cache ? cache->key(text, maxErrors) : 0;
+        if (cache && cache->load(key, text.size(), entry.result)) {
+            auto unit = std::make_unique<Unit>();
+            unit->text = std::move(text);
+            keep(file, entry, std::move(unit));
+            return entry.result;
+        }
+        std::unique_ptr<Unit> unit = build(std::move(text), entry.result);
+        if (cache) {
+            cache->store(key, unit->text.size(), entry.result);
+        }
+        keep(file, entry, std::move(unit));
+        return entry.result;
+    }
+
+    // Edits are not written to the result cache: an editor produces one
+    // version per keystroke, and a later check of the saved file stores it.
+    bool edit(Entry& entry, size_t start, size_t end, std::string_view replacement) {
+        Unit& unit = *entry.unit;
+        size_t before = unit.bytesUsed();
+        size_t oldSize = unit.text.size();
+        unit.text.replace(start, end - start, replacement);
+        entry.hash = Hash::xxh64(unit.text, 0);
+        entry.size = unit.text.size();
+        if (reparse(unit, start, end, replacement.size(), oldSize)) {
+            entry.result = resolve(unit);
+            unitBytes = unitBytes - before + unit.bytesUsed();
+            lru.splice(lru.begin(), lru, entry.recent);
+            evict();
+            return true;
+        }
+        std::string file = *entry.recent;
+        std::string text = std::move(unit.text);
+        dropUnit(entry);
+        keep(file, entry, build(std::move(text), entry.result));
+        return false;
+    }
+
+    // A byte offset, for edit ranges.
+    static bool parseOffset(const Json::Value* value, size_t& out) {
+        if (value == nullptr || value->isString || value->text.empty() || value->text.size() > 10 ||
+            value->text.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        out = std::stoull(value->text);
+        return true;
+    }
+
+    // A copy rather than the mapping itself: the file may change on disk
+    // while its tree is kept.
+    static bool readFile(const std::string& path, std::string& out) {
+        SourceBuffer source;
+        if (!source.open(path.c_str())) {
+            return false;
+        }
+        out.assign(source.text());
+        return true;
+    }
+
+    // Handles one request line; false after shutdown.
+    bool handle(const std::string& line, std::string& out) {
+        Json::Object request;
+        if (!Json::parseObject(line, request)) {
+            out += "{\"id\":null,\"error\":\"Malformed request\"}\n";
+            return true;
+        }
+        auto field = [&](const char* name) -> const Json::Value* {
+            auto it = request.find(name);
+            return it == request.end() ? nullptr : &it->second;
+        };
+        const Json::Value* id = field("id");
+        out += "{\"id\":";
+        out += id == nullptr ? "null" : id->isString ? "\"" + jsonEscape(id->text) + "\"" : id->text;
+        out += ",";
+        const Json::Value* method = field("method");
+        const Json::Value* file = field("file");
+        std::string name = method && method->isString ? method->text : "";
+        if (name == "check" && file && file->isString) {
+            std::string text;
+            const Json::Value* given = field("text");
+            if (given && given->isString) {
+                text = given->text;
+            } else if (!readFile(file->text, text)) {
+                out += "\"error\":\"Could not open file: " + jsonEscape(file->text) + "\"}\n";
+                return true;
+            }
+            appendResultFields(out, check(file->text, std::move(text)));
+        } else if (name == "edit" && file && file->isString) {
+            auto it = files.find(file->text);
+            const Json::Value* given = field("text");
+            size_t start = 0, end = 0;
+            if (it == files.end() || !it->second.unit) {
+                out += "\"error\":\"No text kept for file: " + jsonEscape(file->text) + "\"";
+            } else if (!parseOffset(field("start"), start) || !parseOffset(field("end"), end) || start > end ||
+                       end > it->second.unit->text.size() || !given || !given->isString) {
+                out += "\"error\":\"Invalid edit\"";
+            } else {
+                bool incremental = edit(it->second, start, end, given->text);
+                appendResultFields(out, it->second.result);
+                if (incremental) {
+                    out += ",\"incremental\":true";
+                }
+            }
+        } else if (name == "invalidate" && file && file->isString) {
+            auto it = files.find(file->text);
+            if (it != files.end()) {
+                dropUnit(it->second);
+                files.erase(it);
+            }
+            out += "\"ok\":true";
+        } else if (name == "stats") {
+            out += "\"files\":" + std::to_string(files.size()) + ",\"trees\":" + std::to_string(lru.size()) +
+                   ",\"treeBytes\":" + std::to_string(unitBytes) + ",\"budget\":" + std::to_string(budget);
+        } else if (name == "shutdown") {
+            out += "\"ok\":true}\n";
+            return false;
+        } else {
+            out += "\"error\":\"Unknown method or missing file\"";
+        }
+        out += "}\n";
+        return true;
+    }
+
+public:
+    Server(ThreadPool& pool, size_t maxErrors, const ResultCache* cache, size_t budget)
+        : pool(pool), maxErrors(maxErrors), cache(cache), budget(budget) {}
+
+    int run(std::istream& in, std::ostream& os) {
+        std::string line, out;
+        while (std::getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            out.clear();
+            bool more = handle(line, out);
+            os << out << std::flush;
+            if (!more) {
+                break;
+            }
+        }
+        return 0;
+    }
+};
+
+// Parses a positive decimal count, returning 0 if text is not one.
+static size_t parseCount(const std::string& text) {
+    if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos) {
+        return 0;
+    }
+    return std::stoul(text);
+}
+
+// Peak resident set size of the process so far, or 0 where not available.
+static uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss); // bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+}
+
+// Writes --stats output to stderr, so stdout stays what scripts expect.
+static void printStats(const Stats& stats, bool json) {
+    struct Row {
+        const char* name;
+        const Stats::Phase& phase;
+    };
+    const Row rows[] = {{"read", stats.read},   {"preprocess", stats.preprocess}, {"lex", stats.lex},
+                        {"parse", stats.parse}, {"check", stats.check},           {"total", stats.total}};
+    double tokensPerSecond = stats.lex.wall > 0 ? stats.tokens / stats.lex.wall : 0;
+    uint64_t peak = peakResidentBytes();
+    char line[256];
+    std::string out;
+    if (json) {
+        out = "{\"phases\":{";
+        for (const Row& row : rows) {
+            std::snprintf(line, sizeof line, "%s\"%s\":{\"wallMs\":%.3f,\"cpuMs\":%.3f}", row.name == rows[0].name ? "" : ",",
+                          row.name, row.phase.wall * 1e3, row.phase.cpu * 1e3);
+            out += line;
+        }
+        std::snprintf(line, sizeof line,
+                      "},\"cached\":%s,\"tokens\":%llu,\"tokensPerSecond\":%.0f,\"nodes\":%llu,\"symbols\":%llu,"
+                      "\"symbolBytes\":%llu,\"arenaBytes\":%llu,\"peakRssBytes\":",
+                      stats.cached ? "true" : "false", static_cast<unsigned long long>(stats.tokens), tokensPerSecond,
+                      static_cast<unsigned long long>(stats.nodes), static_cast<unsigned long long>(stats.symbols),
+                      static_cast<unsigned long long>(stats.symbolBytes),
+                      static_cast<unsigned long long>(stats.arenaBytes));
+        out += line;
+        out += peak ? std::to_string(peak) : "null";
+        out += "}\n";
+    } else {
+        out = stats.cached ? "Stats (result from cache):\n" : "Stats:\n";
+        for (const Row& row : rows) {
+            std::snprintf(line, sizeof line, "  %-10s %10.3f ms wall %10.3f ms cpu\n", row.name, row.phase.wall * 1e3,
+                          row.phase.cpu * 1e3);
+            out += line;
+        }
+        std::snprintf(line, sizeof line,
+                      "  tokens     %llu (%.1f M/s)\n  nodes      %llu\n  symbols    %llu (%llu bytes)\n"
+                      "  arena      %llu bytes\n",
+                      static_cast<unsigned long long>(stats.tokens), tokensPerSecond / 1e6,
+                      static_cast<unsigned long long>(stats.nodes), static_cast<unsigned long long>(stats.symbols),
+                      static_cast<unsigned long long>(stats.symbolBytes),
+                      static_cast<unsigned long long>(stats.arenaBytes));
+        out += line;
+        out += "  peak RSS   " + (peak ? std::to_string(peak) + " bytes" : std::string("unknown")) + "\n";
+    }
+    std::cerr << out << std::flush;
+}
+
+static void printUsage() {
+    std::cerr << "Usage: plsa [-j N] [--max-errors N] [--cache-dir DIR] [--emit-ast FILE [--fold]]\n"
+                 "            [--stats[=json]] <input.vira | ->\n"
+                 "       plsa [-j N] [--max-errors N] [--cache-dir DIR] [--emit-ast FILE [--fold]]\n"
+                 "            [--stats[=json]] --preprocess [--emit-pre FILE] <input.vira>\n"
+                 "       plsa [-j N] [--max-errors N] [--cache-dir DIR] [--preprocess]\n"
+                 "            --batch <input | @response-file>...\n"
+                 "       plsa [-j N] [--max-errors N] [--cache-dir DIR] [--memory-budget MB] --serve"
+              << std::endl;
+}
+
+// bench.cpp includes this file for the front end alone.
+#ifndef PLSA_NO_MAIN
+int main(int argc, char* argv[]) {
+    std::vector<std::string> inputs;
+    bool batch = false;
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t maxErrors = Diagnostics::DefaultLimit;
+    std::unique_ptr<ResultCache> cache;
+    bool serve = false;
+    size_t budgetMB = 512;
+    std::string astPath;
+    bool fold = false;
+    bool preprocess = false;
+    std::string prePath;
+    enum class StatsFormat { None, Text, Json } statsFormat = StatsFormat::None;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--stats" || arg == "--stats=text") {
+            statsFormat = StatsFormat::Text;
+        } else if (arg == "--stats=json") {
+            statsFormat = StatsFormat::Json;
+        } else if (arg == "--emit-ast") {
+            astPath = i + 1 < argc ? argv[++i] : "";
+            if (astPath.empty()) {
+                printUsage();
+                return 1;
+            }
+        } else if (arg == "--fold") {
+            fold = true;
+        } else if (arg == "--preprocess") {
+            preprocess = true;
+        } else if (arg == "--emit-pre") {
+            prePath = i + 1 < argc ? argv[++i] : "";
+            if (prePath.empty()) {
+                printUsage();
+                return 1;
+            }
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--memory-budget") {
+            std::string count = i + 1 < argc ? argv[++i] : "";
+            budgetMB = parseCount(count);
+            if (budgetMB == 0) {
+                std::cerr << "Invalid memory budget: " << count << std::endl;
+                return 1;
+            }
+        } else if (arg == "--cache-dir") {
+            std::string dir = i + 1 < argc ? argv[++i] : "";
+            cache = std::make_unique<ResultCache>(dir);
+            if (dir.empty() || !cache->prepare()) {
+                std::cerr << "Could not use cache directory: " << dir << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-errors") {
+            std::string count = i + 1 < argc ? argv[++i] : "";
+            maxErrors = parseCount(count);
+            if (maxErrors == 0) {
+                std::cerr << "Invalid error limit: " << count << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("-j", 0) == 0 && arg.size() > 1) {
+            std::string count = arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[++i] : "");
+            jobs = parseCount(count);
+            if (jobs == 0) {
+                std::cerr << "Invalid job count: " << count << std::endl;
+                return 1;
+            }
+        } else if (arg.size() > 1 && arg[0] == '@') {
+            batch = true;
+            if (!readResponseFile(arg.substr(1), inputs)) {
+                std::cerr << "Could not open response file: " << arg.substr(1) << std::endl;
+                return 1;
+            }
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (serve) {
+        if (batch || !inputs.empty() || !astPath.empty() || fold || preprocess || !prePath.empty() ||
+            statsFormat != StatsFormat::None) {
+            printUsage();
+            return 1;
+        }
+        ThreadPool pool(jobs);
+        Server server(pool, maxErrors, cache.get(), budgetMB << 20);
+        return server.run(std::cin, std::cout);
+    }
+    if (inputs.size() > 1) {
+        batch = true;
+    }
+    if ((inputs.empty() && !batch) || (batch && (!astPath.empty() || statsFormat != StatsFormat::None)) ||
+        (fold && astPath.empty()) || (preprocess && !batch && inputs[0] == "-") ||
+        (!prePath.empty() && (!preprocess || batch))) {
+        printUsage();
+        return 1;
+    }
+    ThreadPool pool(jobs);
+    if (batch) {
+        return runBatch(inputs, pool, maxErrors, cache.get(), preprocess);
+    }
+
+    // Timing starts here rather than at process start, so it leaves out
+    // option parsing and starting the pool.
+    Stats stats;
+    Stats* collect = statsFormat == StatsFormat::None ? nullptr : &stats;
+    PhaseTimer total(collect ? &stats.total : nullptr);
+    CheckResult result;
+    if (preprocess) {
+        // Summaries pay off when other inputs share the includes, which for
+        // a single input means later runs, through the cache.
+        IncludeSummaries summaries(maxErrors, cache.get());
+        result = checkPreprocessed(inputs[0], &pool, maxErrors, cache.get(), cache ? &summaries : nullptr, prePath,
+                                   astPath, fold, collect);
+    } else if (inputs[0] == "-") {
+        // Lexes stdin as it arrives, so plsa can sit at the end of a pipe
+        // from the preprocessor instead of waiting for a finished .pre file.
+        // With a cache the whole input is needed for the key first, and an
+        // AST file records the hash of the whole input. When streaming,
+        // reading happens during lexing and is counted there.
+        StreamSource stdinStream(stdin);
+        if (cache || !astPath.empty()) {
+            PhaseTimer reading(collect ? &stats.read : nullptr);
+            std::string_view text = stdinStream.readAll();
+            reading.stop();
+            result = checkText(text, &pool, maxErrors, cache.get(), astPath, fold, collect);
+        } else {
+            result = checkSource(stdinStream, &pool, maxErrors, nullptr, collect);
+        }
+    } else {
+        // Mapped pages are faulted in as the lexer first touches them, so
+        // most of a mapped file's read time shows up under lexing.
+        SourceBuffer source;
+        PhaseTimer reading(collect ? &stats.read : nullptr);
+        if (!source.open(inputs[0].c_str())) {
+            std::cerr << "Could not open file: " << inputs[0] << std::endl;
+            return 1;
+        }
+        reading.stop();
+        result = checkText(source.text(), &pool, maxErrors, cache.get(), astPath, fold, collect);
+    }
+    total.stop();
+
+    int status = 0;
+    if (!result.ok) {
+        // std::cerr is unbuffered, so the report goes out in one write.
+        std::string report;
+        for (const Message& m : result.errors) {
+            report += "Error: " + formatMessage(m) + "\n";
+        }
+        if (result.truncated) {
+            report += "Stopped after " + std::to_string(maxErrors) + " errors\n";
+        }
+        std::cerr << report << std::flush;
+        status = 1;
+    } else {
+        std::cout << "Parsing and checking successful." << std::endl;
+    }
+    if (collect) {
+        printStats(stats, statsFormat == StatsFormat::Json);
+    }
+    return status;
 }
+#endif
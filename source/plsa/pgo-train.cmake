@@ -0,0 +1,25 @@
+# Runs an instrumented plsa over the benchmark corpus (see CMakeLists.txt).
+# The corpus has inputs with errors on purpose, so plsa's exit status is not
+# checked: recovery paths are worth profiling too.
+execute_process(COMMAND ${BENCH} --emit ${CORPUS} --size 4 RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "plsa-bench could not write the corpus")
+endif()
+
+file(GLOB inputs ${CORPUS}/*.vira)
+foreach(input ${inputs})
+    execute_process(COMMAND ${PLSA} ${input} OUTPUT_QUIET ERROR_QUIET)
+    execute_process(COMMAND ${PLSA} - INPUT_FILE ${input} OUTPUT_QUIET ERROR_QUIET)
+endforeach()
+execute_process(COMMAND ${PLSA} --batch ${inputs} OUTPUT_QUIET ERROR_QUIET)
+
+file(GLOB raw ${PROFILE_DIR}/*.profraw)
+if(raw)
+    if(NOT PROFDATA)
+        message(FATAL_ERROR "Clang profiles need llvm-profdata to merge them")
+    endif()
+    execute_process(COMMAND ${PROFDATA} merge -output=${CLANG_PROFILE} ${raw} RESULT_VARIABLE status)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "llvm-profdata merge failed")
+    endif()
+endif()
@@ -0,0 +1,8 @@
+# Runs plsa on INPUT and compares everything it prints with the .expected
+# file next to INPUT (see CMakeLists.txt).
+execute_process(COMMAND ${PLSA} ${INPUT} OUTPUT_VARIABLE out ERROR_VARIABLE err)
+string(REGEX REPLACE "\\.vira$" ".expected" expected_path ${INPUT})
+file(READ ${expected_path} expected)
+if(NOT "${out}${err}" STREQUAL "${expected}")
+    message(FATAL_ERROR "plsa printed:\n${out}${err}expected:\n${expected}")
+endif()
@@ -182,7 +182,7 @@ void preprocess(FILE *input, FILE *output, const char *filename) {
 
 int main(int argc, char *argv[]) {
     if (argc < 3) {
-        fprintf(stderr, "Usage: preprocessor input.vira output.c\n");
+        fprintf(stderr, "Usage: preprocessor input.vira output.c|-\n");
         return 1;
     }
 
@@ -192,7 +192,9 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    FILE *output = fopen(argv[2], "w");
+    // "-" streams to stdout so the output can be piped straight into plsa
+    int to_stdout = strcmp(argv[2], "-") == 0;
+    FILE *output = to_stdout ? stdout : fopen(argv[2], "w");
     if (!output) {
         fprintf(stderr, "Cannot open output: %s\n", argv[2]);
         fclose(input);
@@ -205,7 +207,11 @@ int main(int argc, char *argv[]) {
 
     preprocess(input, output, argv[1]);
 
-    fclose(output);
+    if (to_stdout) {
+        fflush(output);
+    } else {
+        fclose(output);
+    }
     // Note: input closed in preprocess
 
     for (int i = 0; i < num_defines; i++) {